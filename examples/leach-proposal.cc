@@ -41,6 +41,7 @@
 #include "ns3/energy-module.h"
 #include "ns3/vector.h"
 #include "ns3/leach-packet.h"
+#include "ns3/leach-aggregate.h"
 #include "ns3/udp-header.h"
 #include "ns3/netanim-module.h"
 
@@ -55,6 +56,16 @@ using namespace ns3;
 uint16_t port = 9;
 uint32_t packetsGenerated = 0;
 uint32_t packetsDropped = 0;
+uint32_t packetsSuppressed = 0;
+
+/// Time a reading of the traced node was handled, and its deadline
+struct msmt
+{
+  Time begin;
+  Time end;
+};
+std::vector<struct msmt> timeline;
+std::vector<Time> txTime;
 
 NS_LOG_COMPONENT_DEFINE ("LeachProposal");
 
@@ -89,8 +100,32 @@ CountDroppedPkt (uint32_t oldValue, uint32_t newValue)
   packetsDropped += (newValue - oldValue);
 }
 
+/// readings suppressed as redundant by cluster heads
+void
+CountSuppressedPkt (uint32_t oldValue, uint32_t newValue)
+{
+  packetsSuppressed += (newValue - oldValue);
+}
+
+/// readings the traced node buffered or sent
+void
+RecordTimeline (Time begin, Time end)
+{
+  struct msmt m;
+  m.begin = begin;
+  m.end = end;
+  timeline.push_back (m);
+}
+
+/// transmissions of the traced node
+void
+RecordTxTime (Time t)
+{
+  txTime.push_back (t);
+}
+
 bool
-cmp (struct ns3::leach::msmt a, struct ns3::leach::msmt b)
+cmp (struct msmt a, struct msmt b)
 {
   return (a.begin < b.begin);
 }
@@ -106,7 +141,8 @@ public:
                 std::string phyMode,
                 uint32_t periodicUpdateInterval,
                 double dataStart,
-                double lambda);
+                double lambda,
+                std::string policy);
 
 private:
   uint32_t m_nWifis;
@@ -122,8 +158,7 @@ private:
   uint32_t packetsDecompressed;
   Vector positions[205];
   double m_lambda;
-  std::vector<struct ns3::leach::msmt>* m_timeline;
-  std::vector<Time>* m_txtime;
+  std::string m_policy;
   
   NodeContainer nodes;
   NetDeviceContainer devices;
@@ -153,6 +188,7 @@ int main (int argc, char **argv)
   uint32_t periodicUpdateInterval = 5;
   double dataStart = 0.0;
   double lambda = 1.0;
+  std::string policy ("ns3::leach::NoAggregationPolicy");
 
   CommandLine cmd;
   cmd.AddValue ("nWifis", "Number of WiFi nodes[Default:30]", nWifis);
@@ -162,6 +198,7 @@ int main (int argc, char **argv)
   cmd.AddValue ("rate", "CBR traffic rate[Default:8kbps]", rate);
   cmd.AddValue ("periodicUpdateInterval", "Periodic Interval Time[Default=5]", periodicUpdateInterval);
   cmd.AddValue ("dataStart", "Time at which nodes start to transmit data[Default=0.0]", dataStart);
+  cmd.AddValue ("policy", "Data aggregation policy[Default:ns3::leach::NoAggregationPolicy]", policy);
   cmd.Parse (argc, argv);
 
   SeedManager::SetSeed (12345);
@@ -172,7 +209,7 @@ int main (int argc, char **argv)
   Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", StringValue ("2000"));
 
   test = LeachProposal ();
-  test.CaseRun (nWifis, nSinks, totalTime, rate, phyMode, periodicUpdateInterval, dataStart, lambda);
+  test.CaseRun (nWifis, nSinks, totalTime, rate, phyMode, periodicUpdateInterval, dataStart, lambda, policy);
   
   return 0;
 }
@@ -196,19 +233,14 @@ LeachProposal::ReceivePacket (Ptr <Socket> socket)
   
   while ((packet = socket->Recv ()))
     {
-      leach::LeachHeader leachHeader;
-      
       bytesTotal += packet->GetSize();
       packetSize += packet->GetSize();
 //      NS_LOG_UNCOND("packet size: " << packet->GetSize());
 //      packet->Print(std::cout);
 
-      while(packet->GetSize() >= 56) {
-        packet->RemoveHeader(leachHeader);
-        packet->RemoveAtStart(16);
-//        NS_LOG_UNCOND(leachHeader);
-        
-        if(leachHeader.GetDeadline() > Simulator::Now()) packetsDecompressed++;
+      leach::AggregateDecoder decoder (packet);
+      for (uint32_t i = 0; decoder.IsValid () && i < decoder.GetCount (); i++) {
+        if(decoder.GetDeadline (i) > Simulator::Now()) packetsDecompressed++;
         else packetsReceivedYetExpired++;
         packetCount++;
       }
@@ -234,7 +266,8 @@ LeachProposal::SetupPacketReceive (Ipv4Address addr, Ptr <Node> node)
 
 void
 LeachProposal::CaseRun (uint32_t nWifis, uint32_t nSinks, double totalTime, std::string rate,
-                           std::string phyMode, uint32_t periodicUpdateInterval, double dataStart, double lambda)
+                           std::string phyMode, uint32_t periodicUpdateInterval, double dataStart, double lambda,
+                           std::string policy)
 {
   m_nWifis = nWifis;
   m_nSinks = nSinks;
@@ -244,6 +277,7 @@ LeachProposal::CaseRun (uint32_t nWifis, uint32_t nSinks, double totalTime, std:
   m_periodicUpdateInterval = periodicUpdateInterval;
   m_dataStart = dataStart;
   m_lambda = lambda;
+  m_policy = policy;
 
   std::stringstream ss;
   ss << m_nWifis;
@@ -296,6 +330,7 @@ LeachProposal::CaseRun (uint32_t nWifis, uint32_t nSinks, double totalTime, std:
   std::cout << "Total bytes received: " << bytesTotal << "\n";
   std::cout << "Total packets received/decompressed/received yet expired+dropped/generated: " << packetsReceived << "/" << packetsDecompressed
                  << "/" << packetsReceivedYetExpired + packetsDropped << "/" << packetsGenerated << "\n";
+  std::cout << "Total readings suppressed as redundant: " << packetsSuppressed << "\n";
   for (uint32_t i=0; i<m_nWifis; i++)
     {
       Ptr<BasicEnergySource> basicSourcePtr = DynamicCast<BasicEnergySource> (sources.Get (i));
@@ -312,17 +347,13 @@ LeachProposal::CaseRun (uint32_t nWifis, uint32_t nSinks, double totalTime, std:
   std::cout << "Avg Idle time(ms) / Avg Tx Time(ms) / Avg Rx Time(ms): " << avgIdle/m_nWifis << "/" << avgTx/m_nWifis << "/" << avgRx/m_nWifis << "\n";
   std::cout << "Avg Tx energy(mJ) / Avg Rx energy(mJ): " << energyTx/m_nWifis << "/" << energyRx/m_nWifis << "\n";
 
-  Ptr<leach::RoutingProtocol> leachTracer = DynamicCast<leach::RoutingProtocol> ((nodes.Get(m_nWifis/2))->GetObject<Ipv4> ()->GetRoutingProtocol());
-  m_timeline = leachTracer->getTimeline();
-  m_txtime = leachTracer->getTxTime();
-	
-  sort(m_timeline->begin(), m_timeline->end(), cmp);
-  for (std::vector<struct ns3::leach::msmt>::iterator it=m_timeline->begin(); it!=m_timeline->end(); ++it)
+  sort(timeline.begin(), timeline.end(), cmp);
+  for (std::vector<struct msmt>::iterator it=timeline.begin(); it!=timeline.end(); ++it)
     {
       fprintf(pfile, "%.6f, %.6f\n", it->begin.GetSeconds(), it->end.GetSeconds());
     }
 //  sort(tx_time->begin(), tx_time->end());
-  for (std::vector<Time>::iterator it=m_txtime->begin(); it!=m_txtime->end(); ++it)
+  for (std::vector<Time>::iterator it=txTime.begin(); it!=txTime.end(); ++it)
     {
       fprintf(p2file, "%.6f\n", it->GetSeconds());
     }
@@ -431,7 +462,10 @@ LeachProposal::InstallInternetStack (std::string tr_name)
 {
   LeachHelper leach;
   leach.Set ("Lambda", DoubleValue (m_lambda));
+  leach.Set ("AggregationPolicy", TypeIdValue (TypeId::LookupByName (m_policy)));
   leach.Set ("PeriodicUpdateInterval", TimeValue (Seconds (m_periodicUpdateInterval)));
+  leach.Set ("StopTime", TimeValue (Seconds (m_totalTime)));
+  leach.Set ("SinkPosition", Vector3DValue (positions[0]));
   InternetStackHelper stack;
   uint32_t count = 0;
   int j=0;
@@ -443,6 +477,12 @@ LeachProposal::InstallInternetStack (std::string tr_name)
       stack.Install (*i);
       Ptr<leach::RoutingProtocol> leachTracer = DynamicCast<leach::RoutingProtocol> ((*i)->GetObject<Ipv4> ()->GetRoutingProtocol());
       leachTracer->TraceConnectWithoutContext ("DroppedCount", MakeCallback (&CountDroppedPkt));
+      leachTracer->TraceConnectWithoutContext ("SuppressedCount", MakeCallback (&CountSuppressedPkt));
+      if (j == (int) m_nWifis/2)
+        {
+          leachTracer->TraceConnectWithoutContext ("Timeline", MakeCallback (&RecordTimeline));
+          leachTracer->TraceConnectWithoutContext ("TxTime", MakeCallback (&RecordTxTime));
+        }
     }
   //stack.Install (nodes);        // should give change to leach protocol on the position property
   Ipv4AddressHelper address;
@@ -0,0 +1,156 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+/*
+ * Counts heap allocations made while reading the deadline of buffered data
+ * packets, comparing the old copy-and-RemoveHeader path against
+ * LeachHeader::PeekDeadline, and the allocations per PacketQueue::Enqueue.
+ *
+ *   ./waf --run "leach-queue-benchmark --packets=10000"
+ */
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/leach-packet.h"
+#include "ns3/leach-packet-queue.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE ("LeachQueueBenchmark");
+
+static uint64_t g_allocations = 0;
+
+void *
+operator new (std::size_t size)
+{
+  g_allocations++;
+  void *p = std::malloc (size ? size : 1);
+  if (p == 0)
+    {
+      throw std::bad_alloc ();
+    }
+  return p;
+}
+
+void
+operator delete (void *p) throw ()
+{
+  std::free (p);
+}
+
+/// Deadline read the way the queue used to: copy the packet and strip the header
+static Time
+CopyDeadline (Ptr<const Packet> p)
+{
+  leach::LeachHeader hdr;
+  Packet a (*p);
+  a.RemoveHeader (hdr);
+  return hdr.GetDeadline ();
+}
+
+static void
+Report (std::string name, uint64_t allocations, int64_t ms, uint32_t n)
+{
+  std::cout << name << ": " << allocations << " allocations ("
+            << (double) allocations / n << " per packet), "
+            << ms << " ms" << std::endl;
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint32_t packets = 10000;
+  uint32_t rounds = 10;
+
+  CommandLine cmd;
+  cmd.AddValue ("packets", "Number of buffered data packets", packets);
+  cmd.AddValue ("rounds", "Number of deadline scans over the buffer", rounds);
+  cmd.Parse (argc, argv);
+
+  // Same settings as the routing protocol, which turns metadata on at start
+  PacketMetadata::Enable ();
+  Packet::EnablePrinting ();
+
+  std::vector<Ptr<Packet> > buffer;
+  for (uint32_t i = 0; i < packets; i++)
+    {
+      Ptr<Packet> p = Create<Packet> (16);
+      leach::LeachHeader hdr (Vector (i, i, 0), Ipv4Address ("10.1.1.1"), MilliSeconds (i));
+      p->AddHeader (hdr);
+      buffer.push_back (p);
+    }
+
+  SystemWallClockMs clock;
+  Time sum;
+  uint64_t before;
+
+  before = g_allocations;
+  clock.Start ();
+  for (uint32_t r = 0; r < rounds; r++)
+    {
+      for (uint32_t i = 0; i < packets; i++)
+        {
+          sum += CopyDeadline (buffer[i]);
+        }
+    }
+  Report ("copy + RemoveHeader", g_allocations - before, clock.End (), packets * rounds);
+
+  before = g_allocations;
+  clock.Start ();
+  for (uint32_t r = 0; r < rounds; r++)
+    {
+      for (uint32_t i = 0; i < packets; i++)
+        {
+          sum += leach::LeachHeader::PeekDeadline (buffer[i]);
+        }
+    }
+  Report ("PeekDeadline", g_allocations - before, clock.End (), packets * rounds);
+
+  leach::PacketQueue queue;
+  Ipv4Header ipv4;
+  ipv4.SetDestination (Ipv4Address ("10.1.1.1"));
+  before = g_allocations;
+  clock.Start ();
+  for (uint32_t i = 0; i < packets; i++)
+    {
+      leach::QueueEntry entry (buffer[i], ipv4);
+      queue.Enqueue (entry);
+    }
+  Report ("PacketQueue::Enqueue", g_allocations - before, clock.End (), packets);
+
+  NS_LOG_INFO ("checksum " << sum.GetSeconds ());
+  return 0;
+}
@@ -0,0 +1,122 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+/*
+ * Times route lookups in a small member table and a 1000 entry sink table,
+ * comparing the std::map the routing table used to be, looked up by copy,
+ * against RoutingTable::LookupRoute returning a pointer.
+ *
+ *   ./waf --run "leach-rtable-benchmark --lookups=1000000"
+ */
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/leach-rtable.h"
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace ns3;
+
+NS_LOG_COMPONENT_DEFINE ("LeachRtableBenchmark");
+
+static void
+Report (std::string name, int64_t ms, uint32_t n)
+{
+  std::cout << name << ": " << ms << " ms (" << 1e6 * ms / n << " ns per lookup)" << std::endl;
+}
+
+/// Look up the destinations of a table of size entries in turn, lookups times in all
+static void
+Run (uint32_t size, uint32_t lookups)
+{
+  std::map<Ipv4Address, leach::RoutingTableEntry> map;
+  leach::RoutingTable table;
+  std::vector<Ipv4Address> destinations;
+  Ipv4Address nextHop ("10.1.1.2");
+  Ipv4InterfaceAddress iface (Ipv4Address ("10.1.1.1"), Ipv4Mask ("255.255.0.0"));
+  for (uint32_t i = 0; i < size; i++)
+    {
+      Ipv4Address dst (0x0a010002 + i);
+      leach::RoutingTableEntry rt (0, dst, iface, nextHop);
+      map.insert (std::make_pair (dst, rt));
+      table.AddRoute (rt);
+      destinations.push_back (dst);
+    }
+
+  SystemWallClockMs clock;
+  uint32_t found = 0;
+  std::cout << size << " entries" << std::endl;
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; i++)
+    {
+      std::map<Ipv4Address, leach::RoutingTableEntry>::const_iterator j = map.find (destinations[i % size]);
+      if (j != map.end ())
+        {
+          leach::RoutingTableEntry rt = j->second;
+          found += (rt.GetNextHop () == nextHop);
+        }
+    }
+  Report ("  std::map, copy", clock.End (), lookups);
+
+  clock.Start ();
+  for (uint32_t i = 0; i < lookups; i++)
+    {
+      const leach::RoutingTableEntry *rt = table.LookupRoute (destinations[i % size]);
+      if (rt)
+        {
+          found += (rt->GetNextHop () == nextHop);
+        }
+    }
+  Report ("  RoutingTable, pointer", clock.End (), lookups);
+
+  NS_LOG_INFO ("found " << found);
+}
+
+int
+main (int argc, char *argv[])
+{
+  uint32_t members = 10;
+  uint32_t routes = 1000;
+  uint32_t lookups = 1000000;
+
+  CommandLine cmd;
+  cmd.AddValue ("members", "Entries of the member table", members);
+  cmd.AddValue ("routes", "Entries of the sink table", routes);
+  cmd.AddValue ("lookups", "Lookups per table", lookups);
+  cmd.Parse (argc, argv);
+
+  Run (members, lookups);
+  Run (routes, lookups);
+  return 0;
+}
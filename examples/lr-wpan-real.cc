@@ -44,6 +44,8 @@
 #include "ns3/netanim-module.h"
 
 #include "ns3/leach-packet.h"
+#include "ns3/leach-aggregate.h"
+#include "ns3/leach-policy-library.h"
 
 #include <iostream>
 #include <cstdio>
@@ -66,15 +68,15 @@ using namespace std;
 static bool AggregationPolicy (int);
 static void Aggregate (Ptr<Packet>, int);
 static void Enqueue (Ptr<Packet>, int);
-
-#ifdef DA_PROP
-static bool Proposal (int);
-#endif
-#ifdef DA_OPT
-static bool OptTM (int);
-#endif
-#ifdef DA_CL
-static bool ControlLimit (int);
+static void Drain (void);
+
+// Aggregation rule of the gateways, shared with LEACH routing
+#if defined(DA_PROP)
+typedef leach::ProposalRule GatewayRule;
+#elif defined(DA_OPT)
+typedef leach::OptTmRule GatewayRule;
+#else
+typedef leach::ControlLimitRule GatewayRule;
 #endif
 
 static NodeContainer nodes, gw;
@@ -85,9 +87,11 @@ static NetDeviceContainer devs, sink_dev;
 static Ipv4InterfaceContainer sink_inf, devs_inf;
 static uint32_t total_packet = 0, measurementCount = 0;
 static uint32_t m_dropped = 0, total_gened = 0, gened[16];
-static vector<Ptr<Packet>> gw_buffer[4];
+static leach::DeadlineBuffer<Ptr<Packet> > gw_buffer[4];
+static GatewayRule gw_rule[4];
 static int m_lambda = 2;
 static Time rx_time[22], tx_time[22], from_time[22];
+static bool draining = false;
 static int periodic = 1;
 EnergySourceContainer sources;
 
@@ -151,10 +155,6 @@ static void StateChangeNotification (std::string context, Time now, LrWpanPhyEnu
   }
 }
 
-double max(double a, double b) {
-    return (a>b)?a:b;
-}
-
 class iotTest{
 public:
   void Run();
@@ -199,13 +199,10 @@ iotTest::ReceivePacket (Ptr <Socket> socket)
   Ptr <Packet> packet;
 	
   while (packet = socket->Recv()) {
-    leach::LeachHeader hdr;
+    leach::AggregateDecoder decoder (packet);
 	  
-    while(packet->GetSize()) {
-      packet->RemoveHeader(hdr);
-      packet->RemoveAtStart(17);
-		
-      if(hdr.GetDeadline() < Simulator::Now()) m_dropped++;
+    for (uint32_t i = 0; decoder.IsValid () && i < decoder.GetCount (); i++) {
+      if(decoder.GetDeadline (i) < Simulator::Now()) m_dropped++;
       else measurementCount++;
     }
   }
@@ -373,6 +370,8 @@ iotTest::Run ()
     }
   
 	
+  // Send whatever the gateways still hold shortly before the stop time
+  Simulator::Schedule (Seconds (20.0 - 1.1), &Drain);
   Simulator::Stop (Seconds (20.0));
   Simulator::Run ();
 
@@ -469,162 +468,20 @@ iotTest::ScheduleNext (int index)
   TxPkt(index);
 }
 
-#ifdef DA_PROP
-static bool
-Proposal (int gw_index)
-{
-  // pick up those selected entry and send
-  int expired = 0, expected;
-  leach::LeachHeader hdr;
-  Time deadLine = Now();
-  deadLine += Seconds(gw_buffer[gw_index].size()/m_lambda);
-  
-  for (int i=0; i<(int)gw_buffer[gw_index].size(); i++)
-    {
-      Packet a (*gw_buffer[gw_index][i]);
-      a.RemoveHeader(hdr);
-  
-//      NS_LOG_UNCOND("GetDeadline: " << hdr.GetDeadline() << ", UID: " << gw_buffer[gw_index][i]->GetUid() << ", Now: " << Now());
-      if(hdr.GetDeadline() < Now())
-        {
-          // drop it
-          NS_LOG_UNCOND("Drop");
-          gw_buffer[gw_index].erase (gw_buffer[gw_index].begin()+i);
-          m_dropped++;
-          i--;
-        }
-    }
-  
-  for(uint32_t i=0; i<gw_buffer[gw_index].size(); i++) {
-    Packet a (*gw_buffer[gw_index][i]);
-    a.RemoveHeader(hdr);
-	  
-    if(hdr.GetDeadline() < deadLine) {
-      expired++;
-    }
-  }
-  expected = 4;
-  
-  if(expired >= expected || Now() > Seconds(48.5)) {
-    return true;
-  }
-  return false;
-}
-#endif
-
-#ifdef DA_OPT
-static bool
-OptTM (int gw_index)
-{
-  Time time = Now();
-  uint32_t rewards[100], maxR = 0;
-  uint32_t actions[100];
-  static int step = 0;
-  leach::LeachHeader hdr;
-  
-  for(int i=0; i<100; i++)
-    {
-      actions[i] = 0;
-      rewards[i] = 0;
-      for(uint j=0; j<gw_buffer[gw_index].size(); j++)
-        {
-          Packet a (*gw_buffer[gw_index][j]);
-          a.RemoveHeader(hdr);
-
-          if(hdr.GetDeadline() >= time) rewards[i] += hdr.GetDeadline().ToInteger(Time::MS) - time.ToInteger(Time::MS);
-        }
-      for(int j=1; j<i+step; j++)
-        {
-          rewards[i] += (j<8) ?30000-j*4000 :0;
-        }
-      time += Seconds(1/m_lambda);
-    }
-  
-  for(int i=0; i<100; i++)
-    {
-      if(rewards[i] > maxR)
-        {
-          maxR = rewards[i];
-        }
-    }
-  
-  // wait=1, transmit=2
-  for(int i=98; i>=0; i--)
-    {
-      if(rewards[i] < maxR)
-        actions[i] = 1;
-      else
-        {
-          double rb[100], rn[100];
-          rb[99] = 1.0;
-          rn[99] = 0.0;
-
-          for(int k=98; k>i; k--)
-            {
-              rn[k] = max(0.0, i*rn[k+1]/(k+1) + rb[k+1]/(k+1));
-              rb[k] = max(rewards[k], rn[k]);
-            }
-
-          if(rewards[i] >= (uint32_t)rb[i+1])
-            actions[i] = 2;
-          else
-            actions[i] = 1;
-        }
-    }
-  step++;
-  
-  if(actions[0] > 1 || Now() > Seconds(48.5))
-    {
-      return true;
-    }
-  
-  return false;
-}
-#endif
-
-#ifdef DA_CL
-static bool
-ControlLimit (int gw_index)
-{
-  static uint32_t threshold = (1/(log(1/0.1)*(log(1/0.1)+m_lambda)))+2;
-  leach::LeachHeader hdr;
-	
-  for(int i=0; i<(int)gw_buffer[gw_index].size(); i++)
-    {
-      Packet a (*gw_buffer[gw_index][i]);
-      a.RemoveHeader(hdr);
-
-      if(hdr.GetDeadline() < Now())
-        {
-          gw_buffer[gw_index].erase (gw_buffer[gw_index].begin()+i);
-          m_dropped++;
-          i--;
-        }
-    }
-    
-  if(gw_buffer[gw_index].size() >= threshold || Now() > Seconds(48.5))
-    {
-      return true;
-    }
-  return false;
-}
-#endif
-
 static bool
 AggregationPolicy (int gw_index)
 {
   // Implement data aggregation policy
   // and data addgregation function
 
-  if (Simulator::Now() > Seconds(18.9)) return true;
-#ifdef DA_PROP
-  return Proposal(gw_index);
-#endif
-#ifdef DA_OPT
-  return OptTM(gw_index);
-#endif
-#ifdef DA_CL
-  return ControlLimit(gw_index);
+  if (draining) return true;
+#if defined(DA_PROP) || defined(DA_OPT) || defined(DA_CL)
+  // A gateway acts as a cluster head; Proposal waits for 4 readings due
+  leach::AggregationContext ctx;
+  ctx.lambda = m_lambda;
+  ctx.clusterHead = true;
+  ctx.members = 3;
+  return gw_rule[gw_index].Decide (gw_buffer[gw_index], ctx, Now (), m_dropped);
 #endif
   
   return true;
@@ -633,9 +490,11 @@ AggregationPolicy (int gw_index)
 static void
 Aggregate (Ptr<Packet> p, int gw_index)
 {
-  for (int i=0; i<(int)gw_buffer[gw_index].size(); i++)
-    p->AddAtEnd (gw_buffer[gw_index][i]);
-  gw_buffer[gw_index].clear ();
+  leach::AggregateEncoder encoder (p, leach::LeachHeader::PeekDeadline (p));
+  for (uint32_t i=0; i<gw_buffer[gw_index].GetSize (); i++)
+    encoder.Add (gw_buffer[gw_index].Get (i), gw_buffer[gw_index].GetDeadline (i));
+  encoder.Finish ();
+  gw_buffer[gw_index].Clear ();
 	
   return ;
 }
@@ -643,6 +502,21 @@ Aggregate (Ptr<Packet> p, int gw_index)
 static void
 Enqueue (Ptr<Packet> p, int gw_index)
 {
-  gw_buffer[gw_index].push_back (p);
+  gw_buffer[gw_index].Push (p, leach::LeachHeader::PeekDeadline (p));
+}
+
+static void
+Drain (void)
+{
+  draining = true;
+  for (int i=0; i<4; i++)
+    {
+      if (gw_buffer[i].IsEmpty ()) continue;
+      leach::AggregateEncoder encoder;
+      for (uint32_t j=0; j<gw_buffer[i].GetSize (); j++)
+        encoder.Add (gw_buffer[i].Get (j), gw_buffer[i].GetDeadline (j));
+      gw_buffer[i].Clear ();
+      gw_socket[i]->Send (encoder.Finish ());
+    }
 }
 
@@ -33,6 +33,7 @@
 #include "ns3/node-list.h"
 #include "ns3/names.h"
 #include "ns3/ipv4-list-routing.h"
+#include "ns3/ipv4.h"
 
 namespace ns3 {
 LeachHelper::~LeachHelper ()
@@ -64,4 +65,41 @@ LeachHelper::Set (std::string name, const AttributeValue &value)
   m_agentFactory.Set (name, value);
 }
 
+void
+LeachHelper::Drain (NodeContainer c) const
+{
+  for (NodeContainer::Iterator i = c.Begin (); i != c.End (); ++i)
+    {
+      Ptr<Node> node = (*i);
+      Ptr<Ipv4> ipv4 = node->GetObject<Ipv4> ();
+      NS_ASSERT_MSG (ipv4, "Ipv4 not installed on node");
+      Ptr<Ipv4RoutingProtocol> proto = ipv4->GetRoutingProtocol ();
+      NS_ASSERT_MSG (proto, "Ipv4 routing not installed on node");
+      Ptr<leach::RoutingProtocol> leach = DynamicCast<leach::RoutingProtocol> (proto);
+      if (leach)
+        {
+          leach->Drain ();
+          continue;
+        }
+      // LEACH may also be in a list routing protocol
+      Ptr<Ipv4ListRouting> list = DynamicCast<Ipv4ListRouting> (proto);
+      if (list)
+        {
+          int16_t priority;
+          Ptr<Ipv4RoutingProtocol> listProto;
+          Ptr<leach::RoutingProtocol> listLeach;
+          for (uint32_t j = 0; j < list->GetNRoutingProtocols (); j++)
+            {
+              listProto = list->GetRoutingProtocol (j, priority);
+              listLeach = DynamicCast<leach::RoutingProtocol> (listProto);
+              if (listLeach)
+                {
+                  listLeach->Drain ();
+                  break;
+                }
+            }
+        }
+    }
+}
+
 }
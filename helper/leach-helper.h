@@ -70,6 +70,14 @@ public:
    * This method controls the attributes of ns3::leach::RoutingProtocol
    */
   void Set (std::string name, const AttributeValue &value);
+  /**
+   * \param c NodeContainer of the set of nodes whose LEACH instances
+   *          should send their buffered readings now
+   *
+   * Calls ns3::leach::RoutingProtocol::Drain on every node in c that runs
+   * LEACH, either directly or below an Ipv4ListRouting.
+   */
+  void Drain (NodeContainer c) const;
 
 private:
   ObjectFactory m_agentFactory; //!< Object factory
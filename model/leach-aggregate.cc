@@ -0,0 +1,202 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-aggregate.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachAggregate");
+
+namespace leach {
+
+AggregateEncoder::AggregateEncoder (AggregateHeader::Format format)
+  : m_header (format)
+{
+}
+
+AggregateEncoder::AggregateEncoder (Ptr<Packet> packet, Time deadline,
+                                    AggregateHeader::Format format)
+  : m_header (format)
+{
+  Start (packet, deadline, format);
+}
+
+void
+AggregateEncoder::Start (Ptr<Packet> packet, Time deadline,
+                         AggregateHeader::Format format)
+{
+  NS_ASSERT (packet->GetSize () <= 0xffff);
+  if (m_header.GetFormat () != format)
+    {
+      m_header = AggregateHeader (format);
+    }
+  m_header.Clear ();
+  m_frame = packet;
+  if (format == AggregateHeader::COMPACT)
+    {
+      LeachHeader reading;
+      packet->RemoveHeader (reading);
+      reading.SetDeadline (deadline);
+      m_header.AddRecord (packet->GetSize (), reading);
+      return;
+    }
+  m_header.AddRecord (packet->GetSize (), deadline);
+}
+
+uint32_t
+AggregateEncoder::GetReadingHeaderSize ()
+{
+  static const uint32_t size = LeachHeader ().GetSerializedSize ();
+  return size;
+}
+
+void
+AggregateEncoder::Add (Ptr<const Packet> record, Time deadline)
+{
+  NS_ASSERT (record->GetSize () <= 0xffff);
+  if (m_frame == 0)
+    {
+      m_frame = Create<Packet> ();
+    }
+  if (m_header.GetFormat () == AggregateHeader::COMPACT)
+    {
+      NS_ASSERT (record->GetSize () >= GetReadingHeaderSize ());
+      LeachHeader reading;
+      record->PeekHeader (reading);
+      reading.SetDeadline (deadline);
+      uint32_t length = record->GetSize () - GetReadingHeaderSize ();
+      m_header.AddRecord (length, reading);
+      m_frame->AddAtEnd (record->CreateFragment (GetReadingHeaderSize (), length));
+      return;
+    }
+  m_header.AddRecord (record->GetSize (), deadline);
+  m_frame->AddAtEnd (record);
+}
+
+uint32_t
+AggregateEncoder::GetSizeAfter (Ptr<const Packet> record, Time deadline) const
+{
+  if (m_header.GetFormat () == AggregateHeader::PLAIN)
+    {
+      return GetSizeAfter (record->GetSize ());
+    }
+  LeachHeader reading;
+  record->PeekHeader (reading);
+  reading.SetDeadline (deadline);
+  uint32_t length = record->GetSize () - GetReadingHeaderSize ();
+  return GetSize () + m_header.GetRecordSize (length, reading) + length;
+}
+
+Ptr<Packet>
+AggregateEncoder::Finish ()
+{
+  NS_LOG_FUNCTION (this << m_header.GetCount ());
+  Ptr<Packet> frame = m_frame;
+  if (frame == 0)
+    {
+      frame = Create<Packet> ();
+    }
+  frame->AddHeader (m_header);
+  m_header.Clear ();
+  m_frame = 0;
+  return frame;
+}
+
+AggregateDecoder::AggregateDecoder (Ptr<const Packet> frame)
+  : m_frame (frame),
+    m_readingHeaderSize (0),
+    m_valid (false)
+{
+  // Read the record count first, so a truncated table is never deserialized
+  uint8_t prefix[3];
+  if (frame->CopyData (prefix, 3) < 3)
+    {
+      NS_LOG_DEBUG ("Frame too short: " << frame->GetSize ());
+      return;
+    }
+  uint32_t count = (prefix[1] << 8) | prefix[2];
+  if (prefix[0] == AggregateHeader::PLAIN)
+    {
+      if (frame->GetSize () < AggregateHeader::GetSerializedSize (count))
+        {
+          NS_LOG_DEBUG ("Record table truncated: " << frame->GetSize ());
+          return;
+        }
+    }
+  else if (prefix[0] == AggregateHeader::COMPACT)
+    {
+      // Deserialized with bounds checks, as its size depends on the records
+      m_readingHeaderSize = LeachHeader ().GetSerializedSize ();
+    }
+  else
+    {
+      NS_LOG_DEBUG ("Unknown frame format " << (uint16_t) prefix[0]);
+      return;
+    }
+  frame->PeekHeader (m_header);
+  if (!m_header.IsValid ())
+    {
+      NS_LOG_DEBUG ("Malformed record table");
+      return;
+    }
+  uint32_t offset = m_header.GetSerializedSize ();
+  if (frame->GetSize () != offset + m_header.GetPayloadSize ())
+    {
+      NS_LOG_DEBUG ("Frame holds " << frame->GetSize () << " bytes, expected "
+                                   << offset + m_header.GetPayloadSize ());
+      return;
+    }
+  m_offsets.reserve (count);
+  for (uint32_t i = 0; i < count; i++)
+    {
+      m_offsets.push_back (offset);
+      offset += m_header.GetLength (i);
+    }
+  m_valid = true;
+}
+
+Ptr<Packet>
+AggregateDecoder::GetRecord (uint32_t i) const
+{
+  NS_ASSERT (m_valid && i < m_offsets.size ());
+  Ptr<Packet> record = m_frame->CreateFragment (m_offsets[i], m_header.GetLength (i));
+  if (m_header.GetFormat () == AggregateHeader::COMPACT)
+    {
+      record->AddHeader (LeachHeader (m_header.GetPosition (i), m_header.GetAddress (i),
+                                      m_header.GetDeadline (i)));
+    }
+  return record;
+}
+
+}
+}
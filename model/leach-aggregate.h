@@ -0,0 +1,155 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_AGGREGATE_H
+#define LEACH_AGGREGATE_H
+
+#include "leach-packet.h"
+#include "ns3/packet.h"
+#include "ns3/nstime.h"
+
+#include <vector>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Builds an aggregate frame out of readings
+ *
+ * Records are opaque byte strings, normally a LeachHeader followed by the
+ * sensed payload, and may differ in size.  In a COMPACT frame they must be
+ * readings: their LeachHeader goes into the record table.
+ */
+class AggregateEncoder
+{
+public:
+  /// Build the frame in a new packet
+  AggregateEncoder (AggregateHeader::Format format = AggregateHeader::PLAIN);
+  /**
+   * Build the frame in place; the current contents of packet become its
+   * first record
+   * \param packet the packet turned into a frame by Finish
+   * \param deadline deadline of the first record
+   * \param format encoding of the record table
+   */
+  AggregateEncoder (Ptr<Packet> packet, Time deadline,
+                    AggregateHeader::Format format = AggregateHeader::PLAIN);
+  /**
+   * Drop what was added so far and build the next frame in place, as the
+   * constructor does; the record tables keep their storage
+   */
+  void Start (Ptr<Packet> packet, Time deadline, AggregateHeader::Format format);
+  /// Append record, due at deadline
+  void Add (Ptr<const Packet> record, Time deadline);
+  /// Number of records added
+  uint32_t GetCount () const
+  {
+    return m_header.GetCount ();
+  }
+  /// Size of the frame built so far, header included
+  uint32_t GetSize () const
+  {
+    return m_header.GetSerializedSize () + m_header.GetPayloadSize ();
+  }
+  /// Size a PLAIN frame would have with one more record of length bytes
+  uint32_t GetSizeAfter (uint32_t length) const
+  {
+    NS_ASSERT (m_header.GetFormat () == AggregateHeader::PLAIN);
+    return AggregateHeader::GetSerializedSize (m_header.GetCount () + 1) + m_header.GetPayloadSize () + length;
+  }
+  /// Size the frame would have with record added, in either format
+  uint32_t GetSizeAfter (Ptr<const Packet> record, Time deadline) const;
+  /**
+   * Prepend the record table; the encoder then starts over with a new packet,
+   * created by the next Add
+   * \return the frame
+   */
+  Ptr<Packet> Finish ();
+
+private:
+  /// Size of the LeachHeader a COMPACT frame strips from each record
+  static uint32_t GetReadingHeaderSize ();
+  /// Record table of the frame being built
+  AggregateHeader m_header;
+  /// Records added so far, null until the first one
+  Ptr<Packet> m_frame;
+};
+
+/**
+ * \ingroup leach
+ * \brief Random access to the records of an aggregate frame
+ *
+ * The frame is parsed once; records are then handed out as fragments of
+ * it, in any order.
+ */
+class AggregateDecoder
+{
+public:
+  /// Parse the record table of frame, which is left untouched
+  AggregateDecoder (Ptr<const Packet> frame);
+  /// Check that the format is known and that the frame holds every record
+  bool IsValid () const
+  {
+    return m_valid;
+  }
+  uint32_t GetCount () const
+  {
+    return m_header.GetCount ();
+  }
+  /// Size of record i as GetRecord returns it
+  uint32_t GetLength (uint32_t i) const
+  {
+    return m_header.GetLength (i) + m_readingHeaderSize;
+  }
+  Time GetDeadline (uint32_t i) const
+  {
+    return m_header.GetDeadline (i);
+  }
+  /// Record i, sharing the buffer of the frame; the LeachHeader of a
+  /// COMPACT record is rebuilt in front of it
+  Ptr<Packet> GetRecord (uint32_t i) const;
+
+private:
+  Ptr<const Packet> m_frame;
+  AggregateHeader m_header;
+  /// Bytes of LeachHeader each record lacks in the frame
+  uint32_t m_readingHeaderSize;
+  /// Offset of each record in the frame
+  std::vector<uint32_t> m_offsets;
+  bool m_valid;
+};
+
+}
+}
+
+#endif /* LEACH_AGGREGATE_H */
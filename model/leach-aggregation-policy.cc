@@ -0,0 +1,215 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-aggregation-policy.h"
+#include "ns3/log.h"
+#include "ns3/simulator.h"
+#include "ns3/double.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachAggregationPolicy");
+
+namespace leach {
+
+NS_OBJECT_ENSURE_REGISTERED (AggregationPolicy);
+NS_OBJECT_ENSURE_REGISTERED (NoAggregationPolicy);
+NS_OBJECT_ENSURE_REGISTERED (ProposalPolicy);
+NS_OBJECT_ENSURE_REGISTERED (SelectiveForwardingPolicy);
+NS_OBJECT_ENSURE_REGISTERED (OptTmPolicy);
+NS_OBJECT_ENSURE_REGISTERED (ControlLimitPolicy);
+
+TypeId
+AggregationPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::AggregationPolicy")
+    .SetParent<Object> ()
+    .SetGroupName ("Leach")
+    ;
+  return tid;
+}
+
+AggregationPolicy::AggregationPolicy ()
+{
+}
+
+AggregationPolicy::~AggregationPolicy ()
+{
+}
+
+bool
+AggregationPolicy::IsAggregating (void) const
+{
+  return true;
+}
+
+bool
+AggregationPolicy::Admit (const QueueEntry &entry, const AggregationContext &ctx)
+{
+  return true;
+}
+
+TypeId
+NoAggregationPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::NoAggregationPolicy")
+    .SetParent<AggregationPolicy> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<NoAggregationPolicy> ()
+    ;
+  return tid;
+}
+
+bool
+NoAggregationPolicy::IsAggregating (void) const
+{
+  return false;
+}
+
+bool
+NoAggregationPolicy::Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped)
+{
+  return true;
+}
+
+TypeId
+ProposalPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::ProposalPolicy")
+    .SetParent<AggregationPolicy> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<ProposalPolicy> ()
+    ;
+  return tid;
+}
+
+bool
+ProposalPolicy::Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped)
+{
+  NS_LOG_FUNCTION (this);
+  return m_rule.Decide (queue, ctx, Now (), dropped);
+}
+
+TypeId
+SelectiveForwardingPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::SelectiveForwardingPolicy")
+    .SetParent<ProposalPolicy> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<SelectiveForwardingPolicy> ()
+    .AddAttribute ("SpatialWindow", "Distance in meters within which readings are redundant",
+                   DoubleValue (10.0),
+                   MakeDoubleAccessor (&SelectiveForwardingPolicy::m_spatialWindow),
+                   MakeDoubleChecker<double> (0.0))
+    .AddAttribute ("TemporalWindow", "Time within which readings are redundant",
+                   TimeValue (MilliSeconds (500)),
+                   MakeTimeAccessor (&SelectiveForwardingPolicy::m_temporalWindow),
+                   MakeTimeChecker ())
+    ;
+  return tid;
+}
+
+SelectiveForwardingPolicy::SelectiveForwardingPolicy ()
+  : m_spatialWindow (10.0),
+    m_temporalWindow (MilliSeconds (500))
+{
+}
+
+bool
+SelectiveForwardingPolicy::Admit (const QueueEntry &entry, const AggregationContext &ctx)
+{
+  NS_LOG_FUNCTION (this);
+  if (!ctx.clusterHead)
+    {
+      return true;
+    }
+  Time now = Now ();
+  while (!m_window.empty () && m_window.front ().admitted + m_temporalWindow <= now)
+    {
+      m_window.pop_front ();
+    }
+  LeachHeader hdr;
+  entry.GetPacket ()->PeekHeader (hdr);
+  Vector position = hdr.GetPosition ();
+  for (std::deque<Reading>::const_iterator i = m_window.begin (); i != m_window.end (); ++i)
+    {
+      if (CalculateDistance (i->position, position) <= m_spatialWindow)
+        {
+          NS_LOG_LOGIC ("Reading from " << hdr.GetAddress () << " is redundant");
+          return false;
+        }
+    }
+  Reading reading;
+  reading.position = position;
+  reading.admitted = now;
+  m_window.push_back (reading);
+  return true;
+}
+
+TypeId
+OptTmPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::OptTmPolicy")
+    .SetParent<AggregationPolicy> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<OptTmPolicy> ()
+    ;
+  return tid;
+}
+
+bool
+OptTmPolicy::Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped)
+{
+  NS_LOG_FUNCTION (this);
+  return m_rule.Decide (queue, ctx, Now (), dropped);
+}
+
+TypeId
+ControlLimitPolicy::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::ControlLimitPolicy")
+    .SetParent<AggregationPolicy> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<ControlLimitPolicy> ()
+    ;
+  return tid;
+}
+
+bool
+ControlLimitPolicy::Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped)
+{
+  NS_LOG_FUNCTION (this);
+  return m_rule.Decide (queue, ctx, Now (), dropped);
+}
+
+}
+}
@@ -0,0 +1,187 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_AGGREGATION_POLICY_H
+#define LEACH_AGGREGATION_POLICY_H
+
+#include "leach-packet-queue.h"
+#include "leach-policy-library.h"
+#include "ns3/object.h"
+#include "ns3/nstime.h"
+#include "ns3/vector.h"
+
+#include <deque>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Base class of the data aggregation policies
+ *
+ * A policy decides, for every data packet leaving the node, whether the
+ * readings buffered in the routing layer are merged into that packet and sent
+ * now, or whether the packet joins the buffer as well.  The decisions
+ * themselves are the rules of leach-policy-library.h, applied to the
+ * PacketQueue of the routing protocol.
+ */
+class AggregationPolicy : public Object
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  AggregationPolicy ();
+  virtual
+  ~AggregationPolicy ();
+
+  /// Whether data is buffered at all; if not, packets are forwarded as they come
+  virtual bool
+  IsAggregating (void) const;
+  /**
+   * Decide whether to flush the buffer now
+   * \param queue buffered readings, expired ones may be dropped from it
+   * \param ctx state of the routing protocol
+   * \param dropped incremented for every reading dropped
+   * \return true if the buffer is to be sent with the current packet
+   */
+  virtual bool
+  Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped) = 0;
+  /**
+   * Decide whether a reading joins the buffer at all
+   * \param entry reading received for the sink
+   * \param ctx state of the routing protocol
+   * \return false if the reading is dropped as redundant
+   */
+  virtual bool
+  Admit (const QueueEntry &entry, const AggregationContext &ctx);
+};
+
+/**
+ * \ingroup leach
+ * \brief Forward every reading on its own
+ */
+class NoAggregationPolicy : public AggregationPolicy
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  virtual bool
+  IsAggregating (void) const;
+  virtual bool
+  Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped);
+};
+
+/**
+ * \ingroup leach
+ * \brief Send when enough buffered readings are due before the next expected one
+ */
+class ProposalPolicy : public AggregationPolicy
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  virtual bool
+  Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped);
+
+private:
+  ProposalRule m_rule;
+};
+
+/**
+ * \ingroup leach
+ * \brief Proposal, with cluster heads suppressing redundant member readings
+ *
+ * A reading is redundant if one taken within SpatialWindow of its position
+ * was admitted less than TemporalWindow ago; the admitted reading then
+ * stands for both.  Only cluster heads suppress, members buffer everything.
+ */
+class SelectiveForwardingPolicy : public ProposalPolicy
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  SelectiveForwardingPolicy ();
+  virtual bool
+  Admit (const QueueEntry &entry, const AggregationContext &ctx);
+
+private:
+  /// A reading admitted within the last TemporalWindow
+  struct Reading
+  {
+    Vector position; ///< where it was taken
+    Time admitted; ///< when it was admitted
+  };
+  /// Admitted readings, oldest first
+  std::deque<Reading> m_window;
+  /// Distance within which readings are redundant
+  double m_spatialWindow;
+  /// Time within which readings are redundant
+  Time m_temporalWindow;
+};
+
+/**
+ * \ingroup leach
+ * \brief Optimal stopping over the next 100 packet arrivals
+ */
+class OptTmPolicy : public AggregationPolicy
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  virtual bool
+  Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped);
+
+private:
+  /// Stopping rule, stepped once per decision of this node
+  OptTmRule m_rule;
+};
+
+/**
+ * \ingroup leach
+ * \brief Send once the buffer reaches a threshold derived from lambda
+ */
+class ControlLimitPolicy : public AggregationPolicy
+{
+public:
+  static TypeId
+  GetTypeId (void);
+  virtual bool
+  Decide (PacketQueue &queue, const AggregationContext &ctx, uint32_t &dropped);
+
+private:
+  ControlLimitRule m_rule;
+};
+
+}
+}
+
+#endif /* LEACH_AGGREGATION_POLICY_H */
@@ -0,0 +1,220 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-cluster-partition.h"
+#include "ns3/log.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachClusterPartition");
+
+namespace leach {
+
+ClusterPartition::ClusterPartition ()
+{
+}
+
+void
+ClusterPartition::Clear ()
+{
+  m_address.clear ();
+  m_x.clear ();
+  m_y.clear ();
+  m_energy.clear ();
+  m_cluster.clear ();
+  m_distance.clear ();
+  m_heads.clear ();
+}
+
+void
+ClusterPartition::Add (Ipv4Address address, Vector position, double energy)
+{
+  m_address.push_back (address.Get ());
+  m_x.push_back (position.x);
+  m_y.push_back (position.y);
+  m_energy.push_back (energy);
+}
+
+void
+ClusterPartition::Assign (const std::vector<double> &cx, const std::vector<double> &cy)
+{
+  uint32_t n = m_x.size ();
+  const double *x = &m_x[0];
+  const double *y = &m_y[0];
+  double *distance = &m_distance[0];
+  uint32_t *cluster = &m_cluster[0];
+  std::fill (m_distance.begin (), m_distance.end (), std::numeric_limits<double>::max ());
+  for (uint32_t c = 0; c < cx.size (); c++)
+    {
+      double px = cx[c];
+      double py = cy[c];
+      for (uint32_t i = 0; i < n; i++)
+        {
+          double dx = x[i] - px;
+          double dy = y[i] - py;
+          double d = dx * dx + dy * dy;
+          bool closer = d < distance[i];
+          distance[i] = closer ? d : distance[i];
+          cluster[i] = closer ? c : cluster[i];
+        }
+    }
+}
+
+uint32_t
+ClusterPartition::Closest (double x, double y, double minEnergy, const std::vector<bool> &taken) const
+{
+  uint32_t best = m_x.size ();
+  double bestDistance = std::numeric_limits<double>::max ();
+  for (uint32_t i = 0; i < m_x.size (); i++)
+    {
+      double dx = m_x[i] - x;
+      double dy = m_y[i] - y;
+      double d = dx * dx + dy * dy;
+      if (!taken[i] && m_energy[i] >= minEnergy && d < bestDistance)
+        {
+          best = i;
+          bestDistance = d;
+        }
+    }
+  return best;
+}
+
+uint32_t
+ClusterPartition::Partition (uint32_t k, Ptr<UniformRandomVariable> rng, uint32_t iterations)
+{
+  uint32_t n = m_x.size ();
+  m_heads.clear ();
+  if (n == 0)
+    {
+      return 0;
+    }
+  k = std::max<uint32_t> (1, std::min (k, n));
+  m_cluster.assign (n, 0);
+  m_distance.assign (n, 0);
+
+  // k-means++ seeding: each next center is drawn with probability
+  // proportional to the squared distance to the closest center so far
+  std::vector<double> cx, cy;
+  uint32_t first = rng->GetInteger (0, n - 1);
+  cx.push_back (m_x[first]);
+  cy.push_back (m_y[first]);
+  while (cx.size () < k)
+    {
+      Assign (cx, cy);
+      double total = 0;
+      for (uint32_t i = 0; i < n; i++)
+        {
+          total += m_distance[i];
+        }
+      if (total <= 0)
+        {
+          // Fewer distinct positions than clusters
+          break;
+        }
+      double r = rng->GetValue (0, total);
+      uint32_t next = 0;
+      for (; next + 1 < n && r >= m_distance[next]; next++)
+        {
+          r -= m_distance[next];
+        }
+      cx.push_back (m_x[next]);
+      cy.push_back (m_y[next]);
+    }
+  k = cx.size ();
+
+  std::vector<double> sx (k), sy (k);
+  std::vector<uint32_t> count (k);
+  std::vector<uint32_t> previous;
+  for (uint32_t it = 0; it < iterations; it++)
+    {
+      previous = m_cluster;
+      Assign (cx, cy);
+      if (it > 0 && previous == m_cluster)
+        {
+          break;
+        }
+      std::fill (sx.begin (), sx.end (), 0);
+      std::fill (sy.begin (), sy.end (), 0);
+      std::fill (count.begin (), count.end (), 0);
+      for (uint32_t i = 0; i < n; i++)
+        {
+          sx[m_cluster[i]] += m_x[i];
+          sy[m_cluster[i]] += m_y[i];
+          count[m_cluster[i]]++;
+        }
+      for (uint32_t c = 0; c < k; c++)
+        {
+          // An empty cluster keeps its center
+          if (count[c] > 0)
+            {
+              cx[c] = sx[c] / count[c];
+              cy[c] = sy[c] / count[c];
+            }
+        }
+    }
+
+  // Heads are taken among the nodes with at least the mean energy
+  double mean = 0;
+  for (uint32_t i = 0; i < n; i++)
+    {
+      mean += m_energy[i];
+    }
+  mean /= n;
+  std::vector<bool> taken (n, false);
+  std::vector<double> hx, hy;
+  for (uint32_t c = 0; c < k; c++)
+    {
+      uint32_t head = Closest (cx[c], cy[c], mean, taken);
+      if (head == n)
+        {
+          head = Closest (cx[c], cy[c], -std::numeric_limits<double>::max (), taken);
+        }
+      taken[head] = true;
+      m_heads.push_back (head);
+      hx.push_back (m_x[head]);
+      hy.push_back (m_y[head]);
+    }
+  Assign (hx, hy);
+  // A head joins its own cluster, even if another head shares its position
+  for (uint32_t c = 0; c < k; c++)
+    {
+      m_cluster[m_heads[c]] = c;
+    }
+  NS_LOG_DEBUG (n << " nodes in " << k << " clusters");
+  return k;
+}
+
+}
+}
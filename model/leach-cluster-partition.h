@@ -0,0 +1,131 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_CLUSTER_PARTITION_H
+#define LEACH_CLUSTER_PARTITION_H
+
+#include "ns3/ipv4-address.h"
+#include "ns3/vector.h"
+#include "ns3/random-variable-stream.h"
+
+#include <vector>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Partition of the reporting nodes into clusters, for LEACH-C
+ *
+ * The sink collects the position and energy of each node, then splits them
+ * with k-means: k-means++ seeding, then Lloyd iterations until no node
+ * changes cluster.  Each cluster head is the node with at least the mean
+ * energy closest to a centroid, and every node joins its closest head.
+ *
+ * Coordinates are kept as separate arrays, and the distance loops run over
+ * all nodes for one centroid at a time, so that they vectorize.
+ */
+class ClusterPartition
+{
+public:
+  /// c-tor
+  ClusterPartition ();
+  /// Forget all nodes
+  void Clear ();
+  /// Add node address at position, with energy the share of its energy left
+  void Add (Ipv4Address address, Vector position, double energy);
+  /// Number of nodes added
+  uint32_t GetN () const
+  {
+    return m_x.size ();
+  }
+  /**
+   * Split the nodes into k clusters, or one per node if there are fewer
+   * \param k number of clusters
+   * \param rng draws the k-means++ seeds
+   * \param iterations maximum number of Lloyd iterations
+   * \return number of clusters
+   */
+  uint32_t Partition (uint32_t k, Ptr<UniformRandomVariable> rng, uint32_t iterations = 20);
+  /// Number of clusters of the last partition
+  uint32_t GetNClusters () const
+  {
+    return m_heads.size ();
+  }
+  /// Head of cluster c
+  Ipv4Address GetHead (uint32_t c) const
+  {
+    return Ipv4Address (m_address[m_heads[c]]);
+  }
+  Ipv4Address GetAddress (uint32_t i) const
+  {
+    return Ipv4Address (m_address[i]);
+  }
+  /// Cluster of node i
+  uint32_t GetCluster (uint32_t i) const
+  {
+    return m_cluster[i];
+  }
+  /// Whether node i heads its cluster
+  bool IsHead (uint32_t i) const
+  {
+    return m_heads[m_cluster[i]] == i;
+  }
+
+private:
+  /**
+   * Set m_cluster[i] to the closest of the points (cx[c], cy[c]), and
+   * m_distance[i] to its squared distance
+   */
+  void Assign (const std::vector<double> &cx, const std::vector<double> &cy);
+  /// Index of the node closest to (x, y) among those not taken, with energy at least minEnergy
+  uint32_t Closest (double x, double y, double minEnergy, const std::vector<bool> &taken) const;
+
+  /// Node addresses
+  std::vector<uint32_t> m_address;
+  /// Node coordinates
+  std::vector<double> m_x;
+  std::vector<double> m_y;
+  /// Share of energy left of each node
+  std::vector<double> m_energy;
+  /// Cluster of each node
+  std::vector<uint32_t> m_cluster;
+  /// Squared distance of each node to its cluster center
+  std::vector<double> m_distance;
+  /// Node heading each cluster
+  std::vector<uint32_t> m_heads;
+};
+
+}
+}
+
+#endif /* LEACH_CLUSTER_PARTITION_H */
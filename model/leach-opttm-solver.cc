@@ -0,0 +1,120 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-opttm-solver.h"
+#include "ns3/log.h"
+
+#include <algorithm>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachOptTmSolver");
+
+namespace leach {
+
+const uint32_t OptTmSolver::HORIZON;
+const uint32_t OptTmSolver::BONUS_STEPS;
+
+OptTmSolver::OptTmSolver ()
+  : m_step (0),
+    m_lambda (0)
+{
+  m_gain.resize (BONUS_STEPS);
+  for (uint32_t s = 0; s < BONUS_STEPS; s++)
+    {
+      uint32_t last = std::min (BONUS_STEPS - s, HORIZON - 1);
+      for (uint32_t i = 1; i <= last; i++)
+        {
+          m_gain[s].push_back (Bonus (s + i) - Bonus (s));
+        }
+    }
+  m_minSize.resize (BONUS_STEPS, 0);
+}
+
+int64_t
+OptTmSolver::Bonus (uint32_t step)
+{
+  int64_t bonus = 0;
+  for (uint32_t j = 1; j < step && j < BONUS_STEPS; j++)
+    {
+      bonus += 30000 - j * 4000;
+    }
+  return bonus;
+}
+
+void
+OptTmSolver::Update (double lambda)
+{
+  NS_LOG_FUNCTION (this << lambda);
+  m_lambda = lambda;
+  m_interval = Seconds (1 / lambda);
+  for (uint32_t s = 0; s < BONUS_STEPS; s++)
+    {
+      // Waiting i arrivals takes at most offset + 1 ms off the slack of each
+      // entry, so a smaller buffer cannot outweigh the bonus gained
+      Time offset;
+      m_minSize[s] = 0;
+      for (uint32_t i = 1; i <= m_gain[s].size (); i++)
+        {
+          offset += m_interval;
+          int64_t lost = offset.ToInteger (Time::MS) + 1;
+          uint32_t size = (m_gain[s][i - 1] + lost - 1) / lost;
+          m_minSize[s] = std::max (m_minSize[s], size);
+        }
+    }
+}
+
+bool
+OptTmSolver::Begin (uint32_t size, double lambda, uint32_t &step, bool &transmit)
+{
+  NS_LOG_FUNCTION (this << size << lambda);
+  NS_ASSERT (lambda > 0);
+  step = m_step++;
+  if (step >= BONUS_STEPS)
+    {
+      transmit = true;
+      return false;
+    }
+  if (lambda != m_lambda)
+    {
+      Update (lambda);
+    }
+  if (size < m_minSize[step])
+    {
+      transmit = false;
+      return false;
+    }
+  return true;
+}
+
+}
+}
@@ -0,0 +1,144 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_OPTTM_SOLVER_H
+#define LEACH_OPTTM_SOLVER_H
+
+#include "ns3/nstime.h"
+
+#include <vector>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Optimal stopping decision of the OptTM aggregation policy
+ *
+ * The reward of transmitting i arrivals from now is the slack left in the
+ * buffer at that time, plus a bonus that grows with the number of decisions
+ * taken and stops growing after the eighth.  Transmitting now is optimal
+ * when no reward within the horizon beats the current one.  As the slack
+ * only shrinks with time, at most eight later arrivals can do so, and the
+ * slack is read from the running deadline sum of the queue.
+ *
+ * The bonus gained by waiting, and the smallest buffer whose slack could
+ * make up for it at the current arrival rate, are kept in a table per step,
+ * rebuilt only when the arrival rate changes.
+ *
+ * Works on any buffer with GetSize () and GetSlack (Time), such as
+ * PacketQueue or DeadlineBuffer.
+ */
+class OptTmSolver
+{
+public:
+  /// c-tor
+  OptTmSolver ();
+  /**
+   * Decide whether to transmit the buffer now, and advance the step
+   * \param buffer buffered readings
+   * \param now current time
+   * \param lambda packet arrival rate, per second
+   * \return true to transmit
+   */
+  template <class Buffer>
+  bool Decide (const Buffer &buffer, Time now, double lambda);
+  /// Number of decisions taken so far
+  uint32_t GetStep () const
+  {
+    return m_step;
+  }
+  /// Start over from the first step
+  void Reset ()
+  {
+    m_step = 0;
+  }
+
+  /// Number of arrivals looked ahead
+  static const uint32_t HORIZON = 100;
+  /// Number of steps after which the bonus stops growing
+  static const uint32_t BONUS_STEPS = 8;
+
+private:
+  /**
+   * Advance the step and settle the decision when the buffer size suffices
+   * \param size number of buffered readings
+   * \param lambda packet arrival rate, per second
+   * \param step set to the step the decision is taken at
+   * \param transmit set to the decision, if settled
+   * \return false if the decision is settled, true if the slack decides
+   */
+  bool Begin (uint32_t size, double lambda, uint32_t &step, bool &transmit);
+  /// Cumulated bonus after step steps
+  static int64_t Bonus (uint32_t step);
+  /// Rebuild the minimum buffer sizes for arrival rate lambda
+  void Update (double lambda);
+
+  /// Number of decisions taken so far
+  uint32_t m_step;
+  /// Arrival rate the table was built for
+  double m_lambda;
+  /// Time between two arrivals
+  Time m_interval;
+  /// m_gain[s][i - 1] is the bonus gained at step s by waiting i arrivals
+  std::vector<std::vector<int64_t> > m_gain;
+  /// m_minSize[s] is the smallest buffer that may be transmitted at step s
+  std::vector<uint32_t> m_minSize;
+};
+
+template <class Buffer>
+bool
+OptTmSolver::Decide (const Buffer &buffer, Time now, double lambda)
+{
+  uint32_t step;
+  bool transmit;
+  if (!Begin (buffer.GetSize (), lambda, step, transmit))
+    {
+      return transmit;
+    }
+  int64_t slack = buffer.GetSlack (now);
+  Time t = now;
+  for (uint32_t i = 1; i <= m_gain[step].size (); i++)
+    {
+      t += m_interval;
+      if (slack - buffer.GetSlack (t) < m_gain[step][i - 1])
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+}
+}
+
+#endif /* LEACH_OPTTM_SOLVER_H */
@@ -41,9 +41,9 @@ NS_LOG_COMPONENT_DEFINE ("LeachPacketQueue");
   
 namespace leach {
 uint32_t
-PacketQueue::GetSize ()
+PacketQueue::GetSize () const
 {
-  return m_queue.size ();
+  return m_size;
 }
 
 bool
@@ -52,59 +52,207 @@ PacketQueue::Enqueue (QueueEntry & entry)
   NS_LOG_FUNCTION ("Enqueing packet destined for" << entry.GetIpv4Header ().GetDestination ());
 
   // NS_LOG_DEBUG("Packet size while enqueing "<<entry.GetPacket()->GetSize());
-  m_queue.push_back (entry);
+  DeadlineEntry index;
+  index.deadline = entry.GetDeadline ();
+  index.fifo = &m_queue[entry.GetIpv4Header ().GetDestination ()];
+  if (m_free.empty ())
+    {
+      index.entry = index.fifo->insert (index.fifo->end (), entry);
+    }
+  else
+    {
+      index.entry = m_free.begin ();
+      *index.entry = entry;
+      index.fifo->splice (index.fifo->end (), m_free, index.entry);
+    }
+  // Deadlines mostly arrive in order, so this lands near the back
+  std::deque<DeadlineEntry>::iterator pos = std::upper_bound (m_deadlines.begin (), m_deadlines.end (),
+                                                              index.deadline, DeadlineAfter);
+  m_deadlines.insert (pos, index);
+  m_deadlineSum += index.deadline.ToInteger (Time::MS);
+  m_size++;
   return true;
 }
 
 void
-PacketQueue::Drop (uint32_t idx)
+PacketQueue::Erase (Fifo *fifo, EntryIterator i)
 {
-  m_queue.erase(m_queue.begin()+idx);
+  std::deque<DeadlineEntry>::iterator pos = std::lower_bound (m_deadlines.begin (), m_deadlines.end (),
+                                                              i->GetDeadline (), DeadlineBefore);
+  while (pos != m_deadlines.end () && pos->entry != i)
+    {
+      ++pos;
+    }
+  NS_ASSERT (pos != m_deadlines.end ());
+  m_deadlines.erase (pos);
+  m_deadlineSum -= i->GetDeadline ().ToInteger (Time::MS);
+  *i = QueueEntry ();
+  m_free.splice (m_free.end (), *fifo, i);
+  m_size--;
 }
+
+void
+PacketQueue::Recycle (std::list<QueueEntry> & entries)
+{
+  for (std::list<QueueEntry>::iterator i = entries.begin (); i != entries.end (); ++i)
+    {
+      *i = QueueEntry ();
+    }
+  m_free.splice (m_free.end (), entries);
+}
+
+uint32_t
+PacketQueue::PurgeExpired (Time now)
+{
+  uint32_t n = 0;
+  while (!m_deadlines.empty () && m_deadlines.front ().deadline < now)
+    {
+      DeadlineEntry &front = m_deadlines.front ();
+      NS_LOG_DEBUG ("Drop expired packet " << front.entry->GetPacket ()->GetUid ());
+      m_deadlineSum -= front.deadline.ToInteger (Time::MS);
+      *front.entry = QueueEntry ();
+      m_free.splice (m_free.end (), *front.fifo, front.entry);
+      m_deadlines.pop_front ();
+      m_size--;
+      n++;
+    }
+  return n;
+}
+
+uint32_t
+PacketQueue::CountDueBefore (Time t) const
+{
+  return std::lower_bound (m_deadlines.begin (), m_deadlines.end (), t, DeadlineBefore) - m_deadlines.begin ();
+}
+
+int64_t
+PacketQueue::GetSlack (Time t) const
+{
+  int64_t now = t.ToInteger (Time::MS);
+  int64_t slack = m_deadlineSum - (int64_t) m_size * now;
+  // Entries already expired at t count as zero rather than negative
+  for (std::deque<DeadlineEntry>::const_iterator i = m_deadlines.begin ();
+       i != m_deadlines.end () && i->deadline < t; ++i)
+    {
+      slack += now - i->deadline.ToInteger (Time::MS);
+    }
+  return slack;
+}
+
 bool
 PacketQueue::Dequeue (Ipv4Address dst, QueueEntry & entry)
 {
   NS_LOG_FUNCTION ("Dequeueing packet destined for" << dst);
-  for (std::vector<QueueEntry>::iterator i = m_queue.begin (); i != m_queue.end (); ++i)
+  std::map<Ipv4Address, Fifo>::iterator i = m_queue.find (dst);
+  if (i == m_queue.end () || i->second.empty ())
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
-        {
-          entry = *i;
-          m_queue.erase (i);
-          return true;
-        }
+      return false;
     }
-  return false;
+  entry = i->second.front ();
+  Erase (&i->second, i->second.begin ());
+  return true;
 }
 
-bool
-PacketQueue::Find (Ipv4Address dst)
+uint32_t
+PacketQueue::DequeueAll (Ipv4Address dst, std::list<QueueEntry> & entries)
 {
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  NS_LOG_FUNCTION ("Dequeueing all packets destined for" << dst);
+  std::map<Ipv4Address, Fifo>::iterator i = m_queue.find (dst);
+  if (i == m_queue.end () || i->second.empty ())
+    {
+      return 0;
+    }
+  Fifo *fifo = &i->second;
+  uint32_t n = fifo->size ();
+  if (n == m_size)
+    {
+      m_deadlines.clear ();
+      m_deadlineSum = 0;
+    }
+  else
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
+      std::deque<DeadlineEntry>::iterator out = m_deadlines.begin ();
+      for (std::deque<DeadlineEntry>::iterator j = m_deadlines.begin (); j != m_deadlines.end (); ++j)
         {
-          NS_LOG_DEBUG ("Find");
-          return true;
+          if (j->fifo != fifo)
+            {
+              *out++ = *j;
+            }
+          else
+            {
+              m_deadlineSum -= j->deadline.ToInteger (Time::MS);
+            }
         }
+      m_deadlines.erase (out, m_deadlines.end ());
     }
-  return false;
+  entries.splice (entries.end (), *fifo);
+  m_size -= n;
+  return n;
+}
+
+bool
+PacketQueue::Find (Ipv4Address dst)
+{
+  return GetCountForPacketsWithDst (dst) > 0;
 }
 
 uint32_t
 PacketQueue::GetCountForPacketsWithDst (Ipv4Address dst)
 {
-  uint32_t count = 0;
-  for (std::vector<QueueEntry>::const_iterator i = m_queue.begin (); i
-       != m_queue.end (); ++i)
+  std::map<Ipv4Address, Fifo>::const_iterator i = m_queue.find (dst);
+  if (i == m_queue.end ())
     {
-      if (i->GetIpv4Header ().GetDestination () == dst)
-        {
-          count++;
-        }
+      return 0;
+    }
+  return i->second.size ();
+}
+
+DeferredQueue::DeferredQueue (uint32_t maxLen)
+  : m_ring (maxLen),
+    m_head (0),
+    m_size (0)
+{
+  NS_ASSERT (maxLen > 0);
+}
+
+bool
+DeferredQueue::Enqueue (const Entry & entry)
+{
+  bool room = (m_size < m_ring.size ());
+  if (!room)
+    {
+      NS_LOG_DEBUG ("Deferred queue full, drop packet " << Front ().packet->GetUid ());
+      Pop ();
+    }
+  m_ring[(m_head + m_size) % m_ring.size ()] = entry;
+  m_size++;
+  return room;
+}
+
+void
+DeferredQueue::Pop ()
+{
+  NS_ASSERT (m_size > 0);
+  m_ring[m_head].packet = 0;
+  m_head = (m_head + 1) % m_ring.size ();
+  m_size--;
+}
+
+void
+DeferredQueue::SetMaxQueueLen (uint32_t len)
+{
+  NS_ASSERT (len > 0);
+  while (m_size > len)
+    {
+      Pop ();
+    }
+  std::vector<Entry> ring (len);
+  for (uint32_t i = 0; i < m_size; i++)
+    {
+      ring[i] = m_ring[(m_head + i) % m_ring.size ()];
     }
-  return count;
+  m_ring.swap (ring);
+  m_head = 0;
 }
 
 }
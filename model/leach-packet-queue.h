@@ -32,6 +32,9 @@
 #ifndef LEACH_PACKETQUEUE_H
 #define LEACH_PACKETQUEUE_H
 
+#include <deque>
+#include <list>
+#include <map>
 #include <vector>
 #include "ns3/ipv4-routing-protocol.h"
 #include "ns3/simulator.h"
@@ -56,12 +59,7 @@ public:
       m_header (h)
   {
     if(pa != 0) {
-      Packet a (*pa);
-//      std::cout << "QueueEntry constructor\n";
-//      pa->Print(std::cout);
-      LeachHeader hdr;
-      a.RemoveHeader(hdr);
-      m_deadline = hdr.GetDeadline();
+      m_deadline = LeachHeader::PeekDeadline (pa);
     }
   }
 
@@ -116,28 +114,63 @@ private:
  * When a route is not available, the packets are queued. Every node can buffer up to 5 packets per
  * destination. We have implemented a "drop front on full" queue where the first queued packet will be dropped
  * to accommodate newer packets.
+ *
+ * Entries are kept in one FIFO per destination, and additionally indexed by
+ * deadline, so expired entries are purged from the front of the index and the
+ * number of entries due before a given time is a binary search.
  */
 class PacketQueue
 {
 public:
   /// Default c-tor
   PacketQueue ()
+    : m_size (0),
+      m_deadlineSum (0)
   {
   }
   /// Push entry in queue, if there is no entry with the same packet and destination address in queue.
   bool Enqueue (QueueEntry & entry);
   /// Return first found (the earliest) entry for given destination
   bool Dequeue (Ipv4Address dst, QueueEntry & entry);
+  /**
+   * Move all entries for destination dst to the end of entries, in arrival order
+   * \return the number of entries moved
+   */
+  uint32_t DequeueAll (Ipv4Address dst, std::list<QueueEntry> & entries);
+  /**
+   * Take back the list nodes of entries, e.g. after DequeueAll, for Enqueue
+   * to reuse; entries is left empty
+   */
+  void Recycle (std::list<QueueEntry> & entries);
   /// Remove all packets with destination IP address dst
 //  void DropPacketWithDst (Ipv4Address dst);
   /// Finds whether a packet with destination dst exists in the queue
   bool Find (Ipv4Address dst);
-  /// Drop the idx-th entry
-  void Drop (uint32_t idx);
   /// Get count of packets with destination dst in the queue
   uint32_t GetCountForPacketsWithDst (Ipv4Address dst);
   /// Number of entries
-  uint32_t GetSize ();
+  uint32_t GetSize () const;
+  /**
+   * Drop all entries whose deadline is before now
+   * \param now current time
+   * \return the number of entries dropped
+   */
+  uint32_t PurgeExpired (Time now);
+  /// Get count of entries with deadline before t
+  uint32_t CountDueBefore (Time t) const;
+  /**
+   * Time left before their deadline, summed over the entries not yet expired
+   * at time t; taken from a running sum of the deadlines, so only entries
+   * expired by t are visited
+   * \param t time the slack is measured from
+   * \return the slack in milliseconds
+   */
+  int64_t GetSlack (Time t) const;
+  /// Deadline of the idx-th entry in deadline order
+  Time GetDeadline (uint32_t idx) const
+  {
+    return m_deadlines[idx].deadline;
+  }
   
   // Fields
   Time GetQueueTimeout () const
@@ -148,20 +181,101 @@ public:
   {
     m_queueTimeout = t;
   }
-  QueueEntry& operator[] (size_t idx)
+
+private:
+  typedef std::list<QueueEntry> Fifo;
+  typedef Fifo::iterator EntryIterator;
+  /// Position of an entry in the deadline index
+  struct DeadlineEntry
+  {
+    Time deadline;
+    Fifo *fifo;
+    EntryIterator entry;
+  };
+
+  /// Remove entry i of fifo from both the queue and the deadline index
+  void Erase (Fifo *fifo, EntryIterator i);
+  static bool DeadlineBefore (const DeadlineEntry &e, Time t)
+  {
+    return e.deadline < t;
+  }
+  static bool DeadlineAfter (Time t, const DeadlineEntry &e)
   {
-    return m_queue[idx];
+    return t < e.deadline;
   }
 
-private:
-  std::vector<QueueEntry> m_queue;
+  /// Entries per destination, in arrival order
+  std::map<Ipv4Address, Fifo> m_queue;
+  /// Entries in deadline order, equal deadlines in arrival order
+  std::deque<DeadlineEntry> m_deadlines;
+  /// Spare list nodes, without packets, reused by Enqueue
+  Fifo m_free;
+  /// Number of entries
+  uint32_t m_size;
+  /// Sum of the deadlines of all entries, in milliseconds
+  int64_t m_deadlineSum;
   /// The maximum period of time that a routing protocol is allowed to buffer a packet for, seconds.
   Time m_queueTimeout;
-  static bool IsEqual (QueueEntry en, const Ipv4Address dst)
+};
+/**
+ * \ingroup leach
+ * \brief Packets forwarded without aggregation, waiting for a route
+ *
+ * A ring buffer of fixed capacity; when it is full the oldest entry is
+ * dropped to accommodate the new one.
+ */
+class DeferredQueue
+{
+public:
+  typedef Ipv4RoutingProtocol::UnicastForwardCallback UnicastForwardCallback;
+  /// Deferred packet
+  struct Entry
+  {
+    /// Forward callback of the packet
+    UnicastForwardCallback ucb;
+    Ptr<const Packet> packet;
+    Ipv4Header header;
+    /// Number of times no route was found for it
+    uint32_t retries;
+  };
+
+  /// c-tor
+  DeferredQueue (uint32_t maxLen = 256);
+  /**
+   * Append entry
+   * \return false if the oldest entry was dropped to make room for it
+   */
+  bool Enqueue (const Entry & entry);
+  /// Oldest entry
+  const Entry & Front () const
   {
-    return (en.GetIpv4Header ().GetDestination () == dst);
+    return m_ring[m_head];
   }
+  /// Remove the oldest entry
+  void Pop ();
+  bool IsEmpty () const
+  {
+    return m_size == 0;
+  }
+  uint32_t GetSize () const
+  {
+    return m_size;
+  }
+  /// Set the capacity, keeping the newest entries
+  void SetMaxQueueLen (uint32_t len);
+  uint32_t GetMaxQueueLen () const
+  {
+    return m_ring.size ();
+  }
+
+private:
+  std::vector<Entry> m_ring;
+  /// Position of the oldest entry
+  uint32_t m_head;
+  /// Number of entries
+  uint32_t m_size;
 };
+
 }
 }
 #endif /* LEACH_PACKETQUEUE_H */
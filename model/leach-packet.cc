@@ -32,10 +32,92 @@
 #include "ns3/address-utils.h"
 #include "ns3/packet.h"
 
+#include <cstring>
+
 namespace ns3 {
 namespace leach {
 
+/// Bytes of the LEB128 encoding of v
+static uint32_t
+VarintSize (uint64_t v)
+{
+  uint32_t size = 1;
+  while (v >= 0x80)
+    {
+      v >>= 7;
+      size++;
+    }
+  return size;
+}
+
+static void
+WriteVarint (Buffer::Iterator &i, uint64_t v)
+{
+  while (v >= 0x80)
+    {
+      i.WriteU8 ((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+  i.WriteU8 (v);
+}
+
+/// \return false if the buffer ends first or the value overflows
+static bool
+ReadVarint (Buffer::Iterator &i, uint64_t &v)
+{
+  v = 0;
+  for (uint32_t shift = 0; shift < 64; shift += 7)
+    {
+      if (i.GetRemainingSize () == 0)
+        {
+          return false;
+        }
+      uint8_t byte = i.ReadU8 ();
+      v |= uint64_t (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+static uint64_t
+ZigZag (int64_t v)
+{
+  return (uint64_t (v) << 1) ^ uint64_t (v >> 63);
+}
+
+static int64_t
+UnZigZag (uint64_t v)
+{
+  return int64_t (v >> 1) ^ -int64_t (v & 1);
+}
+
+static void
+WriteDouble (Buffer::Iterator &i, double v)
+{
+  uint64_t bits;
+  std::memcpy (&bits, &v, sizeof (bits));
+  i.WriteHtonU64 (bits);
+}
+
+static double
+ReadDouble (Buffer::Iterator &i)
+{
+  uint64_t bits = i.ReadNtohU64 ();
+  double v;
+  std::memcpy (&v, &bits, sizeof (v));
+  return v;
+}
+
 NS_OBJECT_ENSURE_REGISTERED (LeachHeader);
+NS_OBJECT_ENSURE_REGISTERED (AggregateHeader);
+NS_OBJECT_ENSURE_REGISTERED (LeachControlHeader);
+NS_OBJECT_ENSURE_REGISTERED (LeachControlTag);
+NS_OBJECT_ENSURE_REGISTERED (ClusterReportHeader);
+NS_OBJECT_ENSURE_REGISTERED (ClusterAssignmentHeader);
+NS_OBJECT_ENSURE_REGISTERED (ClusterScheduleHeader);
     
 LeachHeader::LeachHeader (Vector position, Ipv4Address address, Time m)
   : m_position (position),
@@ -94,10 +176,653 @@ LeachHeader::Deserialize (Buffer::Iterator start)
   return dist;
 }
 
+Time
+LeachHeader::PeekDeadline (Ptr<const Packet> packet)
+{
+  LeachHeader hdr;
+  packet->PeekHeader (hdr);
+  return hdr.GetDeadline ();
+}
+
 void
 LeachHeader::Print (std::ostream &os) const
 {
   os << " Position: " << m_position << ", IP: " << m_address << ", Deadline:" << m_deadline << "\n";
 }
+AggregateHeader::AggregateHeader (Format format)
+  : m_format (format),
+    m_payloadSize (0),
+    m_size (format == COMPACT ? 11 : GetSerializedSize (0)),
+    m_valid (true)
+{
+}
+
+AggregateHeader::~AggregateHeader ()
+{
+}
+
+TypeId
+AggregateHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::AggregateHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<AggregateHeader> ();
+  return tid;
+}
+
+TypeId
+AggregateHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+AggregateHeader::GetSerializedSize (uint32_t count)
+{
+  return 3 + count * 10;
+}
+
+uint32_t
+AggregateHeader::GetSerializedSize () const
+{
+  return m_size;
+}
+
+void
+AggregateHeader::AddRecord (uint16_t length, Time deadline)
+{
+  NS_ASSERT (m_format == PLAIN && m_records.size () < 0xffff);
+  Record record;
+  record.length = length;
+  record.deadline = deadline;
+  m_records.push_back (record);
+  m_payloadSize += length;
+  m_size += 10;
+}
+
+uint32_t
+AggregateHeader::FindPosition (const Vector &position) const
+{
+  for (uint32_t k = 0; k < m_positions.size (); k++)
+    {
+      const Vector &v = m_positions[k];
+      if (v.x == position.x && v.y == position.y && v.z == position.z)
+        {
+          return k + 1;
+        }
+    }
+  return 0;
+}
+
+uint32_t
+AggregateHeader::GetRecordSize (uint16_t length, const LeachHeader &reading) const
+{
+  uint32_t size = VarintSize (length);
+  if (m_records.empty ())
+    {
+      size += VarintSize (reading.GetAddress ().Get ()) + 1 + 1 + 24;
+      return size;
+    }
+  const Record &last = m_records.back ();
+  size += VarintSize (reading.GetAddress ().Get () ^ last.address.Get ());
+  uint32_t ref = FindPosition (reading.GetPosition ());
+  size += VarintSize (ref) + (ref ? 0 : 24);
+  int64_t delta = reading.GetDeadline ().GetNanoSeconds () - m_records.front ().deadline.GetNanoSeconds ();
+  size += VarintSize (ZigZag (delta));
+  return size;
+}
+
+void
+AggregateHeader::AddRecord (uint16_t length, const LeachHeader &reading)
+{
+  NS_ASSERT (m_format == COMPACT && m_records.size () < 0xffff);
+  m_size += GetRecordSize (length, reading);
+  if (FindPosition (reading.GetPosition ()) == 0)
+    {
+      m_positions.push_back (reading.GetPosition ());
+    }
+  Record record;
+  record.length = length;
+  record.deadline = reading.GetDeadline ();
+  record.address = reading.GetAddress ();
+  record.position = reading.GetPosition ();
+  m_records.push_back (record);
+  m_payloadSize += length;
+}
+
+void
+AggregateHeader::Clear ()
+{
+  m_records.clear ();
+  m_positions.clear ();
+  m_payloadSize = 0;
+  m_size = (m_format == COMPACT ? 11 : GetSerializedSize (0));
+  m_valid = true;
+}
+
+void
+AggregateHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteU8 (m_format);
+  i.WriteHtonU16 (m_records.size ());
+  if (m_format == PLAIN)
+    {
+      for (std::vector<Record>::const_iterator r = m_records.begin (); r != m_records.end (); ++r)
+        {
+          i.WriteHtonU16 (r->length);
+          i.WriteHtonU64 (r->deadline.GetNanoSeconds ());
+        }
+      return;
+    }
+  int64_t base = m_records.empty () ? 0 : m_records.front ().deadline.GetNanoSeconds ();
+  i.WriteHtonU64 (base);
+  uint32_t previous = 0;
+  uint32_t positions = 0;
+  for (std::vector<Record>::const_iterator r = m_records.begin (); r != m_records.end (); ++r)
+    {
+      WriteVarint (i, r->address.Get () ^ previous);
+      previous = r->address.Get ();
+      // m_positions lists the positions in order of appearance
+      uint32_t ref = FindPosition (r->position);
+      if (ref > positions)
+        {
+          WriteVarint (i, 0);
+          WriteDouble (i, r->position.x);
+          WriteDouble (i, r->position.y);
+          WriteDouble (i, r->position.z);
+          positions++;
+        }
+      else
+        {
+          WriteVarint (i, ref);
+        }
+      WriteVarint (i, ZigZag (r->deadline.GetNanoSeconds () - base));
+      WriteVarint (i, r->length);
+    }
+}
+
+uint32_t
+AggregateHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  m_format = PLAIN;
+  Clear ();
+  uint8_t format = i.ReadU8 ();
+  if (format == COMPACT)
+    {
+      return DeserializeCompact (start);
+    }
+  if (format != PLAIN)
+    {
+      m_valid = false;
+      return 1;
+    }
+  uint16_t count = i.ReadNtohU16 ();
+  for (uint16_t k = 0; k < count; k++)
+    {
+      uint16_t length = i.ReadNtohU16 ();
+      AddRecord (length, NanoSeconds (i.ReadNtohU64 ()));
+    }
+
+  uint32_t dist = i.GetDistanceFrom (start);
+  NS_ASSERT (dist == GetSerializedSize ());
+  return dist;
+}
+
+uint32_t
+AggregateHeader::DeserializeCompact (Buffer::Iterator start)
+{
+  // The table size is only known once it is read, so every read is checked
+  Buffer::Iterator i = start;
+  m_format = COMPACT;
+  Clear ();
+  m_valid = false;
+  i.ReadU8 ();
+  if (i.GetRemainingSize () < 10)
+    {
+      return i.GetDistanceFrom (start);
+    }
+  uint16_t count = i.ReadNtohU16 ();
+  int64_t base = i.ReadNtohU64 ();
+  uint32_t address = 0;
+  for (uint16_t k = 0; k < count; k++)
+    {
+      uint64_t value, ref, delta, length;
+      if (!ReadVarint (i, value) || value > 0xffffffff)
+        {
+          return i.GetDistanceFrom (start);
+        }
+      address ^= uint32_t (value);
+      if (!ReadVarint (i, ref) || ref > m_positions.size ())
+        {
+          return i.GetDistanceFrom (start);
+        }
+      Vector position;
+      if (ref == 0)
+        {
+          if (i.GetRemainingSize () < 24)
+            {
+              return i.GetDistanceFrom (start);
+            }
+          position.x = ReadDouble (i);
+          position.y = ReadDouble (i);
+          position.z = ReadDouble (i);
+        }
+      else
+        {
+          position = m_positions[ref - 1];
+        }
+      // The first record is the base itself
+      if (!ReadVarint (i, delta) || (k == 0 && delta != 0)
+          || !ReadVarint (i, length) || length > 0xffff)
+        {
+          return i.GetDistanceFrom (start);
+        }
+      AddRecord (length, LeachHeader (position, Ipv4Address (address), NanoSeconds (base + UnZigZag (delta))));
+    }
+
+  // Padded varints decode fine but would not serialize back the same
+  uint32_t dist = i.GetDistanceFrom (start);
+  m_valid = (dist == GetSerializedSize ());
+  return dist;
+}
+
+void
+AggregateHeader::Print (std::ostream &os) const
+{
+  os << " Format: " << (uint16_t) m_format << ", Records: " << m_records.size () << ", Bytes: " << m_payloadSize << "\n";
+}
+
+LeachControlHeader::LeachControlHeader (MessageType type, Vector position)
+  : m_type (type),
+    m_position (position),
+    m_valid (true)
+{
+}
+
+LeachControlHeader::~LeachControlHeader ()
+{
+}
+
+TypeId
+LeachControlHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::LeachControlHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<LeachControlHeader> ();
+  return tid;
+}
+
+TypeId
+LeachControlHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+bool
+LeachControlHeader::HasPosition (uint8_t type)
+{
+  return type == ADV || type == SINK_BEACON;
+}
+
+uint32_t
+LeachControlHeader::GetSerializedSize () const
+{
+  return HasPosition (m_type) ? 17 : 1;
+}
+
+void
+LeachControlHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteU8 (m_type);
+  if (HasPosition (m_type))
+    {
+      WriteDouble (i, m_position.x);
+      WriteDouble (i, m_position.y);
+    }
+}
+
+uint32_t
+LeachControlHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  uint8_t type = i.ReadU8 ();
+  m_position = Vector ();
+  m_valid = (type >= ADV && type <= ASSIGNMENT);
+  if (!m_valid)
+    {
+      return 1;
+    }
+  m_type = MessageType (type);
+  if (HasPosition (m_type))
+    {
+      if (i.GetRemainingSize () < 16)
+        {
+          m_valid = false;
+          return 1;
+        }
+      m_position.x = ReadDouble (i);
+      m_position.y = ReadDouble (i);
+    }
+  return i.GetDistanceFrom (start);
+}
+
+void
+LeachControlHeader::Print (std::ostream &os) const
+{
+  os << " Type: " << (uint16_t) m_type;
+  if (HasPosition (m_type))
+    {
+      os << ", Position: " << m_position;
+    }
+  os << "\n";
+}
+
+LeachControlTag::LeachControlTag ()
+{
+}
+
+TypeId
+LeachControlTag::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::LeachControlTag")
+    .SetParent<Tag> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<LeachControlTag> ();
+  return tid;
+}
+
+TypeId
+LeachControlTag::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+LeachControlTag::GetSerializedSize () const
+{
+  return 0;
+}
+
+void
+LeachControlTag::Serialize (TagBuffer i) const
+{
+}
+
+void
+LeachControlTag::Deserialize (TagBuffer i)
+{
+}
+
+void
+LeachControlTag::Print (std::ostream &os) const
+{
+  os << "LEACH control";
+}
+
+ClusterReportHeader::ClusterReportHeader (Vector position, double energy)
+  : m_position (position),
+    m_energy (energy)
+{
+}
+
+ClusterReportHeader::~ClusterReportHeader ()
+{
+}
+
+TypeId
+ClusterReportHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::ClusterReportHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<ClusterReportHeader> ();
+  return tid;
+}
+
+TypeId
+ClusterReportHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+uint32_t
+ClusterReportHeader::GetSerializedSize () const
+{
+  return 24;
+}
+
+void
+ClusterReportHeader::Serialize (Buffer::Iterator i) const
+{
+  WriteDouble (i, m_position.x);
+  WriteDouble (i, m_position.y);
+  WriteDouble (i, m_energy);
+}
+
+uint32_t
+ClusterReportHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  m_position.x = ReadDouble (i);
+  m_position.y = ReadDouble (i);
+  m_position.z = 0;
+  m_energy = ReadDouble (i);
+  return i.GetDistanceFrom (start);
+}
+
+void
+ClusterReportHeader::Print (std::ostream &os) const
+{
+  os << " Position: " << m_position << ", Energy: " << m_energy << "\n";
+}
+
+ClusterAssignmentHeader::ClusterAssignmentHeader ()
+{
+}
+
+ClusterAssignmentHeader::~ClusterAssignmentHeader ()
+{
+}
+
+TypeId
+ClusterAssignmentHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::ClusterAssignmentHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<ClusterAssignmentHeader> ();
+  return tid;
+}
+
+TypeId
+ClusterAssignmentHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+void
+ClusterAssignmentHeader::AddHead (Ipv4Address head)
+{
+  NS_ASSERT (m_heads.size () < 255);
+  m_heads.push_back (head);
+}
+
+void
+ClusterAssignmentHeader::AddMember (Ipv4Address member, uint8_t cluster)
+{
+  NS_ASSERT (cluster < m_heads.size () && m_members.size () < 0xffff);
+  m_members.push_back (member);
+  m_clusters.push_back (cluster);
+}
+
+bool
+ClusterAssignmentHeader::Find (Ipv4Address address, uint32_t &cluster) const
+{
+  for (uint32_t c = 0; c < m_heads.size (); c++)
+    {
+      if (m_heads[c] == address)
+        {
+          cluster = c;
+          return true;
+        }
+    }
+  for (uint32_t i = 0; i < m_members.size (); i++)
+    {
+      if (m_members[i] == address)
+        {
+          cluster = m_clusters[i];
+          return true;
+        }
+    }
+  return false;
+}
+
+uint32_t
+ClusterAssignmentHeader::GetSerializedSize () const
+{
+  return 3 + 4 * m_heads.size () + 5 * m_members.size ();
+}
+
+void
+ClusterAssignmentHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteU8 (m_heads.size ());
+  i.WriteHtonU16 (m_members.size ());
+  for (std::vector<Ipv4Address>::const_iterator h = m_heads.begin (); h != m_heads.end (); ++h)
+    {
+      WriteTo (i, *h);
+    }
+  for (uint32_t k = 0; k < m_members.size (); k++)
+    {
+      WriteTo (i, m_members[k]);
+      i.WriteU8 (m_clusters[k]);
+    }
+}
+
+uint32_t
+ClusterAssignmentHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  m_heads.clear ();
+  m_members.clear ();
+  m_clusters.clear ();
+  uint8_t heads = i.ReadU8 ();
+  uint16_t members = i.ReadNtohU16 ();
+  for (uint8_t c = 0; c < heads; c++)
+    {
+      Ipv4Address head;
+      ReadFrom (i, head);
+      m_heads.push_back (head);
+    }
+  for (uint16_t k = 0; k < members; k++)
+    {
+      Ipv4Address member;
+      ReadFrom (i, member);
+      m_members.push_back (member);
+      m_clusters.push_back (i.ReadU8 ());
+    }
+  uint32_t dist = i.GetDistanceFrom (start);
+  NS_ASSERT (dist == GetSerializedSize ());
+  return dist;
+}
+
+void
+ClusterAssignmentHeader::Print (std::ostream &os) const
+{
+  os << " Clusters: " << m_heads.size () << ", Members: " << m_members.size () << "\n";
+}
+
+ClusterScheduleHeader::ClusterScheduleHeader (Time start, Time slot)
+  : m_start (start),
+    m_slot (slot)
+{
+}
+
+ClusterScheduleHeader::~ClusterScheduleHeader ()
+{
+}
+
+TypeId
+ClusterScheduleHeader::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::leach::ClusterScheduleHeader")
+    .SetParent<Header> ()
+    .SetGroupName ("Leach")
+    .AddConstructor<ClusterScheduleHeader> ();
+  return tid;
+}
+
+TypeId
+ClusterScheduleHeader::GetInstanceTypeId () const
+{
+  return GetTypeId ();
+}
+
+void
+ClusterScheduleHeader::AddSlot (Ipv4Address member)
+{
+  NS_ASSERT (m_members.size () < 0xffff);
+  m_members.push_back (member);
+}
+
+bool
+ClusterScheduleHeader::Find (Ipv4Address member, uint32_t &slot) const
+{
+  for (uint32_t k = 0; k < m_members.size (); k++)
+    {
+      if (m_members[k] == member)
+        {
+          slot = k;
+          return true;
+        }
+    }
+  return false;
+}
+
+uint32_t
+ClusterScheduleHeader::GetSerializedSize () const
+{
+  return 10 + 4 * m_members.size ();
+}
+
+void
+ClusterScheduleHeader::Serialize (Buffer::Iterator i) const
+{
+  i.WriteHtonU32 (m_start.GetMicroSeconds ());
+  i.WriteHtonU32 (m_slot.GetMicroSeconds ());
+  i.WriteHtonU16 (m_members.size ());
+  for (std::vector<Ipv4Address>::const_iterator m = m_members.begin (); m != m_members.end (); ++m)
+    {
+      WriteTo (i, *m);
+    }
+}
+
+uint32_t
+ClusterScheduleHeader::Deserialize (Buffer::Iterator start)
+{
+  Buffer::Iterator i = start;
+  m_members.clear ();
+  m_start = MicroSeconds (i.ReadNtohU32 ());
+  m_slot = MicroSeconds (i.ReadNtohU32 ());
+  uint16_t slots = i.ReadNtohU16 ();
+  for (uint16_t k = 0; k < slots; k++)
+    {
+      Ipv4Address member;
+      ReadFrom (i, member);
+      m_members.push_back (member);
+    }
+  uint32_t dist = i.GetDistanceFrom (start);
+  NS_ASSERT (dist == GetSerializedSize ());
+  return dist;
+}
+
+void
+ClusterScheduleHeader::Print (std::ostream &os) const
+{
+  os << " Start: " << m_start << ", Slot: " << m_slot << ", Slots: " << m_members.size () << "\n";
+}
 }
 }
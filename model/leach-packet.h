@@ -33,12 +33,18 @@
 #define LEACH_PACKET_H
 
 #include <iostream>
+#include <vector>
 #include "ns3/header.h"
+#include "ns3/tag.h"
+#include "ns3/ptr.h"
 #include "ns3/ipv4-address.h"
 #include "ns3/nstime.h"
 #include "ns3/vector.h"
 
 namespace ns3 {
+
+class Packet;
+
 namespace leach {
 /**
  * \ingroup leach
@@ -104,6 +110,12 @@ public:
   {
     return m_deadline;
   }
+  /**
+   * Read the deadline of the LeachHeader at the front of packet, without
+   * copying or modifying the packet
+   */
+  static Time
+  PeekDeadline (Ptr<const Packet> packet);
   
   void
   Test4 () const
@@ -121,6 +133,373 @@ static inline std::ostream & operator<< (std::ostream& os, const LeachHeader & p
   packet.Print (os);
   return os;
 }
+
+/**
+ * \ingroup leach
+ * \brief Header of an aggregate frame
+ *
+ * Followed by the records themselves, back to back in table order.
+ * PLAIN frames carry each record as it is:
+ * \verbatim
+ |       0       |       1       |       2       |       3       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |    Format     |         Record count          |  Length (1)   |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |               |             Deadline (1), ns                  |
+ +-+-+-+-+-+-+-+-+                               +-+-+-+-+-+-+-+-+
+ |                                               |  Length (2)   |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                              ...                              |
+ * \endverbatim
+ *
+ * COMPACT frames hold readings, i.e. records starting with a LeachHeader,
+ * and move that header into the table.  After the record count comes the
+ * deadline of the first record in ns (64 bit), then per record, as
+ * LEB128 varints:
+ *  - the address XOR the address of the previous record (of 0 for the first)
+ *  - 0 followed by the position (3 doubles) the first time a position
+ *    appears in the frame, or k to repeat the k-th position that appeared
+ *  - the deadline minus that of the first record, in ns, zigzag encoded
+ *  - the length of the record without its LeachHeader
+ */
+class AggregateHeader : public Header
+{
+public:
+  /// Encoding of the record table
+  enum Format
+  {
+    PLAIN = 0, //!< 16 bit length and 64 bit deadline per record
+    COMPACT = 1, //!< LeachHeader of each record packed into the table
+  };
+
+  AggregateHeader (Format format = PLAIN);
+  virtual ~AggregateHeader ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+  virtual void Print (std::ostream &os) const;
+
+  /// Serialized size of a PLAIN header holding count records
+  static uint32_t GetSerializedSize (uint32_t count);
+  /// Append a record of length bytes, due at deadline, to a PLAIN table
+  void AddRecord (uint16_t length, Time deadline);
+  /// Append a reading to a COMPACT table; length excludes its header
+  void AddRecord (uint16_t length, const LeachHeader &reading);
+  /// Bytes AddRecord (length, reading) would add to a COMPACT table
+  uint32_t GetRecordSize (uint16_t length, const LeachHeader &reading) const;
+  /// Remove all records, keeping the format
+  void Clear ();
+  Format
+  GetFormat () const
+  {
+    return m_format;
+  }
+  /// Check that the format is known
+  bool IsValid () const
+  {
+    return m_valid;
+  }
+  uint32_t
+  GetCount () const
+  {
+    return m_records.size ();
+  }
+  uint16_t
+  GetLength (uint32_t i) const
+  {
+    return m_records[i].length;
+  }
+  Time
+  GetDeadline (uint32_t i) const
+  {
+    return m_records[i].deadline;
+  }
+  /// Address of reading i of a COMPACT table
+  Ipv4Address
+  GetAddress (uint32_t i) const
+  {
+    return m_records[i].address;
+  }
+  /// Position of reading i of a COMPACT table
+  Vector
+  GetPosition (uint32_t i) const
+  {
+    return m_records[i].position;
+  }
+  /// Sum of the record lengths
+  uint32_t
+  GetPayloadSize () const
+  {
+    return m_payloadSize;
+  }
+
+private:
+  /// Entry of the record table
+  struct Record
+  {
+    uint16_t length;
+    Time deadline;
+    Ipv4Address address;
+    Vector position;
+  };
+  /// Index of position among the ones in m_positions plus one, or 0
+  uint32_t FindPosition (const Vector &position) const;
+  uint32_t DeserializeCompact (Buffer::Iterator start);
+  Format m_format;
+  std::vector<Record> m_records;
+  /// Distinct positions of a COMPACT table, in order of appearance
+  std::vector<Vector> m_positions;
+  uint32_t m_payloadSize;
+  /// Serialized size of the table
+  uint32_t m_size;
+  bool m_valid;
+};
+static inline std::ostream & operator<< (std::ostream& os, const AggregateHeader & packet)
+{
+  packet.Print (os);
+  return os;
+}
+
+/**
+ * \ingroup leach
+ * \brief Type of a LEACH control message, ahead of its fields
+ *
+ * Type (8 bits), then for ADV and SINK_BEACON the position of the sender,
+ * x and y as 64 bit doubles.  JOIN has no field: the member is the source
+ * of the packet.  SCHEDULE, REPORT and ASSIGNMENT are followed by their
+ * own header.
+ */
+class LeachControlHeader : public Header
+{
+public:
+  /// Kind of control message
+  enum MessageType
+  {
+    ADV = 1, //!< a cluster head advertises itself
+    JOIN = 2, //!< a member joins the cluster head it sends to
+    SCHEDULE = 3, //!< a cluster head sends its TDMA frame, ClusterScheduleHeader
+    SINK_BEACON = 4, //!< the sink tells its position
+    REPORT = 5, //!< LEACH-C report to the sink, ClusterReportHeader
+    ASSIGNMENT = 6, //!< LEACH-C clusters from the sink, ClusterAssignmentHeader
+  };
+
+  LeachControlHeader (MessageType type = JOIN, Vector position = Vector ());
+  virtual ~LeachControlHeader ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+  virtual void Print (std::ostream &os) const;
+
+  MessageType
+  GetType () const
+  {
+    return m_type;
+  }
+  /// Position of the sender of an ADV or SINK_BEACON
+  Vector
+  GetPosition () const
+  {
+    return m_position;
+  }
+  /// Check that the type is known
+  bool
+  IsValid () const
+  {
+    return m_valid;
+  }
+
+private:
+  /// Whether messages of type carry a position
+  static bool HasPosition (uint8_t type);
+  MessageType m_type;
+  Vector m_position;
+  bool m_valid;
+};
+
+/**
+ * \ingroup leach
+ * \brief Packet tag of LEACH control messages, so that RouteOutput does not
+ * take those sent to the sink for readings.  It has no field.
+ */
+class LeachControlTag : public Tag
+{
+public:
+  LeachControlTag ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (TagBuffer i) const;
+  virtual void Deserialize (TagBuffer i);
+  virtual void Print (std::ostream &os) const;
+};
+
+/**
+ * \ingroup leach
+ * \brief Position and energy a node reports to the sink in LEACH-C
+ * \verbatim
+ |       0       |       2       |       4       |       6       |
+  0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7 0 1 2 3 4 5 6 7
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                           Position .x                         |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                           Position .y                         |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ |                        Energy fraction                        |
+ +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ \endverbatim
+ * Each field is a 64 bit double.
+ */
+class ClusterReportHeader : public Header
+{
+public:
+  ClusterReportHeader (Vector position = Vector (), double energy = 1);
+  virtual ~ClusterReportHeader ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+  virtual void Print (std::ostream &os) const;
+
+  Vector
+  GetPosition () const
+  {
+    return m_position;
+  }
+  /// Remaining over initial energy of the node
+  double
+  GetEnergy () const
+  {
+    return m_energy;
+  }
+
+private:
+  Vector m_position;
+  double m_energy;
+};
+
+/**
+ * \ingroup leach
+ * \brief Clusters the sink assigns in LEACH-C, broadcast to all nodes
+ *
+ * Head count (8 bits) and member count (16 bits), then the address of the
+ * head of each cluster, then each member address followed by the index of
+ * its cluster (8 bits).
+ */
+class ClusterAssignmentHeader : public Header
+{
+public:
+  ClusterAssignmentHeader ();
+  virtual ~ClusterAssignmentHeader ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+  virtual void Print (std::ostream &os) const;
+
+  /// Add the head of the next cluster; at most 255 clusters
+  void AddHead (Ipv4Address head);
+  /// Add member of cluster
+  void AddMember (Ipv4Address member, uint8_t cluster);
+  uint32_t
+  GetNHeads () const
+  {
+    return m_heads.size ();
+  }
+  Ipv4Address
+  GetHead (uint32_t c) const
+  {
+    return m_heads[c];
+  }
+  uint32_t
+  GetNMembers () const
+  {
+    return m_members.size ();
+  }
+  Ipv4Address
+  GetMember (uint32_t i) const
+  {
+    return m_members[i];
+  }
+  uint8_t
+  GetCluster (uint32_t i) const
+  {
+    return m_clusters[i];
+  }
+  /**
+   * Find the cluster of address, head or member
+   * \param cluster set to its cluster if found
+   * \return true if found
+   */
+  bool Find (Ipv4Address address, uint32_t &cluster) const;
+
+private:
+  std::vector<Ipv4Address> m_heads;
+  std::vector<Ipv4Address> m_members;
+  std::vector<uint8_t> m_clusters;
+};
+
+/**
+ * \ingroup leach
+ * \brief TDMA schedule a cluster head broadcasts to its members
+ *
+ * Delay from the transmission to the first frame and slot length, both in
+ * microseconds (32 bits), slot count (16 bits), then the address owning
+ * each slot of the frame, in order.
+ */
+class ClusterScheduleHeader : public Header
+{
+public:
+  ClusterScheduleHeader (Time start = Time (), Time slot = Time ());
+  virtual ~ClusterScheduleHeader ();
+  static TypeId GetTypeId (void);
+  virtual TypeId GetInstanceTypeId (void) const;
+  virtual uint32_t GetSerializedSize () const;
+  virtual void Serialize (Buffer::Iterator start) const;
+  virtual uint32_t Deserialize (Buffer::Iterator start);
+  virtual void Print (std::ostream &os) const;
+
+  /// Give the next slot of the frame to member
+  void AddSlot (Ipv4Address member);
+  /// Delay from the transmission to the first frame
+  Time
+  GetStart () const
+  {
+    return m_start;
+  }
+  Time
+  GetSlot () const
+  {
+    return m_slot;
+  }
+  uint32_t
+  GetNSlots () const
+  {
+    return m_members.size ();
+  }
+  Ipv4Address
+  GetMember (uint32_t slot) const
+  {
+    return m_members[slot];
+  }
+  /**
+   * Find the slot of member
+   * \param slot set to its slot if found
+   * \return true if found
+   */
+  bool Find (Ipv4Address member, uint32_t &slot) const;
+
+private:
+  Time m_start;
+  Time m_slot;
+  std::vector<Ipv4Address> m_members;
+};
 }
 }
 
@@ -0,0 +1,225 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_POLICY_LIBRARY_H
+#define LEACH_POLICY_LIBRARY_H
+
+#include "leach-opttm-solver.h"
+#include "ns3/nstime.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Protocol state an aggregation policy bases its decision on
+ */
+struct AggregationContext
+{
+  /// Packet generation rate of this node, estimated online
+  double lambda;
+  /// Whether this node is a cluster head in the current round
+  bool clusterHead;
+  /// Number of members that joined this node
+  uint32_t members;
+};
+
+/**
+ * \ingroup leach
+ * \brief Items of any type, kept in deadline order
+ *
+ * The buffer the aggregation rules below work on, for callers without a
+ * routing layer, e.g. a MAC level gateway.  Like PacketQueue it provides
+ * GetSize, PurgeExpired, CountDueBefore and GetSlack.
+ */
+template <class Item>
+class DeadlineBuffer
+{
+public:
+  DeadlineBuffer ()
+    : m_deadlineSum (0)
+  {
+  }
+  /// Add item, due at deadline; equal deadlines keep arrival order
+  void Push (const Item &item, Time deadline)
+  {
+    Entry entry;
+    entry.item = item;
+    entry.deadline = deadline;
+    m_entries.insert (std::upper_bound (m_entries.begin (), m_entries.end (), deadline, DeadlineAfter),
+                      entry);
+    m_deadlineSum += deadline.ToInteger (Time::MS);
+  }
+  uint32_t GetSize () const
+  {
+    return m_entries.size ();
+  }
+  bool IsEmpty () const
+  {
+    return m_entries.empty ();
+  }
+  /// Item i in deadline order
+  const Item & Get (uint32_t i) const
+  {
+    return m_entries[i].item;
+  }
+  Time GetDeadline (uint32_t i) const
+  {
+    return m_entries[i].deadline;
+  }
+  void Clear ()
+  {
+    m_entries.clear ();
+    m_deadlineSum = 0;
+  }
+  /// Drop all items whose deadline is before now, and return their number
+  uint32_t PurgeExpired (Time now)
+  {
+    uint32_t n = 0;
+    while (!m_entries.empty () && m_entries.front ().deadline < now)
+      {
+        m_deadlineSum -= m_entries.front ().deadline.ToInteger (Time::MS);
+        m_entries.pop_front ();
+        n++;
+      }
+    return n;
+  }
+  /// Number of items with deadline before t
+  uint32_t CountDueBefore (Time t) const
+  {
+    return std::lower_bound (m_entries.begin (), m_entries.end (), t, DeadlineBefore) - m_entries.begin ();
+  }
+  /// Milliseconds left before their deadline, summed over the items not expired at t
+  int64_t GetSlack (Time t) const
+  {
+    int64_t now = t.ToInteger (Time::MS);
+    int64_t slack = m_deadlineSum - (int64_t) m_entries.size () * now;
+    for (typename std::deque<Entry>::const_iterator i = m_entries.begin ();
+         i != m_entries.end () && i->deadline < t; ++i)
+      {
+        slack += now - i->deadline.ToInteger (Time::MS);
+      }
+    return slack;
+  }
+
+private:
+  struct Entry
+  {
+    Item item;
+    Time deadline;
+  };
+  static bool DeadlineBefore (const Entry &e, Time t)
+  {
+    return e.deadline < t;
+  }
+  static bool DeadlineAfter (Time t, const Entry &e)
+  {
+    return t < e.deadline;
+  }
+
+  /// Items in deadline order
+  std::deque<Entry> m_entries;
+  /// Sum of the deadlines, in milliseconds
+  int64_t m_deadlineSum;
+};
+
+/**
+ * \ingroup leach
+ * \brief Send when enough buffered readings are due before the next expected one
+ *
+ * Like the other rules, Decide is a template on the buffer, PacketQueue or
+ * DeadlineBuffer, and expired readings are dropped from it.
+ */
+class ProposalRule
+{
+public:
+  template <class Buffer>
+  bool Decide (Buffer &buffer, const AggregationContext &ctx, Time now, uint32_t &dropped)
+  {
+    // 1.28 = 2*0.64, 0.064 = 64bytes/8kbps
+    // average 10 cluster heads
+    // average 10 members per cluster
+    Time deadLine = now + Seconds (buffer.GetSize () / ctx.lambda);
+    if (!ctx.clusterHead)
+      // depend on average tx size from cluster member
+      // depend on deadline setting
+      // * average packet_size?
+      deadLine += Seconds (0.064 + 1.0 / ctx.lambda);
+
+    dropped += buffer.PurgeExpired (now);
+    uint32_t expected = ctx.clusterHead ? 1 + ctx.members : 1;
+    return (buffer.CountDueBefore (deadLine) >= expected);
+  }
+};
+
+/**
+ * \ingroup leach
+ * \brief Optimal stopping over the next 100 packet arrivals
+ */
+class OptTmRule
+{
+public:
+  template <class Buffer>
+  bool Decide (Buffer &buffer, const AggregationContext &ctx, Time now, uint32_t &dropped)
+  {
+    return m_solver.Decide (buffer, now, ctx.lambda);
+  }
+
+private:
+  /// Stopping rule, stepped once per decision
+  OptTmSolver m_solver;
+};
+
+/**
+ * \ingroup leach
+ * \brief Send once the buffer reaches a threshold derived from lambda
+ */
+class ControlLimitRule
+{
+public:
+  template <class Buffer>
+  bool Decide (Buffer &buffer, const AggregationContext &ctx, Time now, uint32_t &dropped)
+  {
+    uint32_t threshold = (1 / (std::log (1 / 0.1) * (std::log (1 / 0.1) + ctx.lambda))) + 2;
+    dropped += buffer.PurgeExpired (now);
+    return (buffer.GetSize () >= threshold);
+  }
+};
+
+}
+}
+
+#endif /* LEACH_POLICY_LIBRARY_H */
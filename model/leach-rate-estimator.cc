@@ -0,0 +1,83 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-rate-estimator.h"
+#include "ns3/log.h"
+
+#include <algorithm>
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachRateEstimator");
+
+namespace leach {
+
+/// Shortest interval kept, so the rate stays finite for simultaneous arrivals
+static const double MIN_INTERVAL = 1e-6;
+
+RateEstimator::RateEstimator ()
+  : m_weight (0.125),
+    m_interval (1.0),
+    m_count (0)
+{
+}
+
+void
+RateEstimator::SetPrior (double rate)
+{
+  NS_ASSERT (rate > 0);
+  m_interval = 1 / rate;
+  m_count = 0;
+}
+
+void
+RateEstimator::SetWeight (double weight)
+{
+  NS_ASSERT (weight >= 0 && weight <= 1);
+  m_weight = weight;
+}
+
+void
+RateEstimator::Update (Time now)
+{
+  if (m_count > 0)
+    {
+      double sample = (now - m_last).GetSeconds ();
+      m_interval = std::max (MIN_INTERVAL, (1 - m_weight) * m_interval + m_weight * sample);
+    }
+  m_last = now;
+  m_count++;
+  NS_LOG_LOGIC ("Rate " << 1 / m_interval << " after " << m_count << " arrivals");
+}
+
+}
+}
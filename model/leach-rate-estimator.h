@@ -0,0 +1,91 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_RATE_ESTIMATOR_H
+#define LEACH_RATE_ESTIMATOR_H
+
+#include "ns3/nstime.h"
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Online estimate of a packet arrival rate
+ *
+ * Keeps an exponentially weighted moving average of the time between
+ * arrivals, starting from the interval of a prior rate.
+ */
+class RateEstimator
+{
+public:
+  /// c-tor
+  RateEstimator ();
+  /**
+   * Restart from a prior rate
+   * \param rate arrivals per second
+   */
+  void SetPrior (double rate);
+  /// Set the weight of a new sample, in [0, 1]; 0 keeps the prior
+  void SetWeight (double weight);
+  double GetWeight () const
+  {
+    return m_weight;
+  }
+  /// Record an arrival
+  void Update (Time now);
+  /// Estimated rate, arrivals per second
+  double GetRate () const
+  {
+    return 1 / m_interval;
+  }
+  /// Number of arrivals recorded
+  uint32_t GetCount () const
+  {
+    return m_count;
+  }
+
+private:
+  /// Weight of a new sample
+  double m_weight;
+  /// Average time between arrivals, seconds
+  double m_interval;
+  /// Time of the last arrival
+  Time m_last;
+  /// Number of arrivals recorded
+  uint32_t m_count;
+};
+
+}
+}
+
+#endif /* LEACH_RATE_ESTIMATOR_H */
@@ -0,0 +1,263 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#include "leach-reassembly-cache.h"
+#include "ns3/log.h"
+
+namespace ns3 {
+
+NS_LOG_COMPONENT_DEFINE ("LeachReassemblyCache");
+
+namespace leach {
+
+const uint32_t ReassemblyCache::NONE;
+
+ReassemblyCache::ReassemblyCache ()
+  : m_oldest (NONE),
+    m_newest (NONE),
+    m_bytes (0),
+    m_maxBytes (65536),
+    m_timeout (Seconds (3)),
+    m_hits (0),
+    m_misses (0),
+    m_evictions (0)
+{
+  SetMaxEntries (16);
+}
+
+void
+ReassemblyCache::SetMaxEntries (uint32_t n)
+{
+  NS_ASSERT (n > 0);
+  while (m_oldest != NONE)
+    {
+      Evict (m_oldest);
+    }
+  m_pool.resize (n);
+  m_free.clear ();
+  for (uint32_t i = n; i > 0; i--)
+    {
+      m_free.push_back (i - 1);
+    }
+}
+
+Ptr<Packet>
+ReassemblyCache::Add (const Ipv4Header &header, Ptr<Packet> fragment, Time now)
+{
+  if (header.GetFragmentOffset () == 0 && header.IsLastFragment ())
+    {
+      return fragment;
+    }
+  Purge (now);
+
+  Key key (header.GetSource (), header.GetIdentification ());
+  uint32_t idx;
+  std::map<Key, uint32_t>::const_iterator i = m_index.find (key);
+  if (i != m_index.end ())
+    {
+      m_hits++;
+      idx = i->second;
+    }
+  else
+    {
+      m_misses++;
+      idx = Allocate (key);
+    }
+  Entry &entry = m_pool[idx];
+
+  // Fragments mostly arrive in order, so search from the back
+  Fragment f;
+  f.offset = header.GetFragmentOffset ();
+  f.packet = fragment;
+  std::vector<Fragment>::iterator pos = entry.fragments.end ();
+  while (pos != entry.fragments.begin () && (pos - 1)->offset > f.offset)
+    {
+      --pos;
+    }
+  if (pos != entry.fragments.begin () && (pos - 1)->offset == f.offset)
+    {
+      NS_LOG_DEBUG ("Duplicate fragment at " << f.offset << " from " << key.first);
+      return 0;
+    }
+  entry.fragments.insert (pos, f);
+  entry.bytes += fragment->GetSize ();
+  m_bytes += fragment->GetSize ();
+  if (header.IsLastFragment ())
+    {
+      entry.length = f.offset + fragment->GetSize ();
+    }
+  Touch (idx, now);
+
+  if (IsComplete (entry))
+    {
+      Ptr<Packet> p = entry.fragments.front ().packet;
+      for (std::vector<Fragment>::const_iterator j = entry.fragments.begin () + 1; j != entry.fragments.end (); ++j)
+        {
+          p->AddAtEnd (j->packet);
+        }
+      NS_LOG_DEBUG ("Reassembled " << p->GetSize () << " bytes from " << key.first);
+      Release (idx);
+      return p;
+    }
+
+  while (m_bytes > m_maxBytes)
+    {
+      NS_LOG_DEBUG ("Over " << m_maxBytes << " bytes, evict oldest datagram");
+      Evict (m_oldest);
+    }
+  return 0;
+}
+
+uint32_t
+ReassemblyCache::Purge (Time now)
+{
+  uint32_t n = 0;
+  while (m_oldest != NONE && m_pool[m_oldest].updated + m_timeout < now)
+    {
+      NS_LOG_DEBUG ("Fragments from " << m_pool[m_oldest].key.first << " timed out");
+      Evict (m_oldest);
+      n++;
+    }
+  return n;
+}
+
+bool
+ReassemblyCache::IsComplete (const Entry &entry) const
+{
+  if (entry.length == 0 || entry.bytes != entry.length)
+    {
+      return false;
+    }
+  uint32_t expected = 0;
+  for (std::vector<Fragment>::const_iterator i = entry.fragments.begin (); i != entry.fragments.end (); ++i)
+    {
+      if (i->offset != expected)
+        {
+          return false;
+        }
+      expected += i->packet->GetSize ();
+    }
+  return true;
+}
+
+uint32_t
+ReassemblyCache::Allocate (const Key &key)
+{
+  if (m_free.empty ())
+    {
+      NS_LOG_DEBUG ("Pool exhausted, evict oldest datagram");
+      Evict (m_oldest);
+    }
+  uint32_t idx = m_free.back ();
+  m_free.pop_back ();
+  Entry &entry = m_pool[idx];
+  entry.key = key;
+  entry.bytes = 0;
+  entry.length = 0;
+  entry.prev = NONE;
+  entry.next = NONE;
+  m_index[key] = idx;
+  return idx;
+}
+
+void
+ReassemblyCache::Release (uint32_t idx)
+{
+  Entry &entry = m_pool[idx];
+  Unlink (idx);
+  m_index.erase (entry.key);
+  m_bytes -= entry.bytes;
+  // clear () keeps the capacity for the next datagram
+  entry.fragments.clear ();
+  m_free.push_back (idx);
+}
+
+void
+ReassemblyCache::Evict (uint32_t idx)
+{
+  NS_ASSERT (idx != NONE);
+  m_evictions++;
+  Release (idx);
+}
+
+void
+ReassemblyCache::Touch (uint32_t idx, Time now)
+{
+  Entry &entry = m_pool[idx];
+  entry.updated = now;
+  if (idx == m_newest)
+    {
+      return;
+    }
+  if (entry.prev != NONE || entry.next != NONE || idx == m_oldest)
+    {
+      Unlink (idx);
+    }
+  entry.prev = m_newest;
+  entry.next = NONE;
+  if (m_newest != NONE)
+    {
+      m_pool[m_newest].next = idx;
+    }
+  m_newest = idx;
+  if (m_oldest == NONE)
+    {
+      m_oldest = idx;
+    }
+}
+
+void
+ReassemblyCache::Unlink (uint32_t idx)
+{
+  Entry &entry = m_pool[idx];
+  if (entry.prev != NONE)
+    {
+      m_pool[entry.prev].next = entry.next;
+    }
+  else if (m_oldest == idx)
+    {
+      m_oldest = entry.next;
+    }
+  if (entry.next != NONE)
+    {
+      m_pool[entry.next].prev = entry.prev;
+    }
+  else if (m_newest == idx)
+    {
+      m_newest = entry.prev;
+    }
+  entry.prev = NONE;
+  entry.next = NONE;
+}
+
+}
+}
@@ -0,0 +1,182 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Copyright (c) 2010 Hemanth Narra, Yufei Cheng
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Hemanth Narra <hemanth@ittc.ku.com>
+ * Author: Yufei Cheng   <yfcheng@ittc.ku.edu>
+ *
+ * James P.G. Sterbenz <jpgs@ittc.ku.edu>, director
+ * ResiliNets Research Group  http://wiki.ittc.ku.edu/resilinets
+ * Information and Telecommunication Technology Center (ITTC)
+ * and Department of Electrical Engineering and Computer Science
+ * The University of Kansas Lawrence, KS USA.
+ *
+ * Work supported in part by NSF FIND (Future Internet Design) Program
+ * under grant CNS-0626918 (Postmodern Internet Architecture),
+ * NSF grant CNS-1050226 (Multilayer Network Resilience Analysis and Experimentation on GENI),
+ * US Department of Defense (DoD), and ITTC at The University of Kansas.
+ */
+
+#ifndef LEACH_REASSEMBLY_CACHE_H
+#define LEACH_REASSEMBLY_CACHE_H
+
+#include "ns3/ipv4-address.h"
+#include "ns3/ipv4-header.h"
+#include "ns3/packet.h"
+#include "ns3/nstime.h"
+
+#include <map>
+#include <vector>
+
+namespace ns3 {
+namespace leach {
+
+/**
+ * \ingroup leach
+ * \brief Reassembly of the IP fragments of forwarded aggregates
+ *
+ * Datagrams are identified by source address and IP identification.  Their
+ * state lives in a fixed pool of entries that is reused, together with the
+ * fragment vectors, once a datagram completes or is evicted.  Entries are
+ * kept in least recently updated order: the oldest one is evicted when its
+ * last fragment is older than the timeout, when the pool is exhausted, or
+ * when the fragments held exceed the byte cap.
+ */
+class ReassemblyCache
+{
+public:
+  /// c-tor
+  ReassemblyCache ();
+  /**
+   * Add an IP fragment
+   * \param header IP header of the fragment
+   * \param fragment IP payload of the fragment
+   * \param now current time
+   * \return the whole IP payload once every fragment is in, 0 before
+   */
+  Ptr<Packet> Add (const Ipv4Header &header, Ptr<Packet> fragment, Time now);
+  /**
+   * Evict the datagrams not updated within the timeout
+   * \return the number of datagrams evicted
+   */
+  uint32_t Purge (Time now);
+
+  // Fields
+  void SetMaxEntries (uint32_t n);
+  uint32_t GetMaxEntries () const
+  {
+    return m_pool.size ();
+  }
+  void SetMaxBytes (uint32_t bytes)
+  {
+    m_maxBytes = bytes;
+  }
+  uint32_t GetMaxBytes () const
+  {
+    return m_maxBytes;
+  }
+  void SetTimeout (Time t)
+  {
+    m_timeout = t;
+  }
+  Time GetTimeout () const
+  {
+    return m_timeout;
+  }
+  /// Number of datagrams being reassembled
+  uint32_t GetSize () const
+  {
+    return m_index.size ();
+  }
+  /// Bytes held in fragments
+  uint32_t GetBytes () const
+  {
+    return m_bytes;
+  }
+  /// Fragments that joined a datagram already in the cache
+  uint32_t GetHits () const
+  {
+    return m_hits;
+  }
+  /// Fragments that started a new datagram
+  uint32_t GetMisses () const
+  {
+    return m_misses;
+  }
+  /// Datagrams dropped before completion
+  uint32_t GetEvictions () const
+  {
+    return m_evictions;
+  }
+
+private:
+  /// No entry
+  static const uint32_t NONE = 0xffffffff;
+  /// Datagram identification
+  typedef std::pair<Ipv4Address, uint16_t> Key;
+  /// Fragment payload and its offset in the datagram, bytes
+  struct Fragment
+  {
+    uint16_t offset;
+    Ptr<Packet> packet;
+  };
+  /// Datagram being reassembled
+  struct Entry
+  {
+    Key key;
+    /// Fragments in offset order
+    std::vector<Fragment> fragments;
+    /// Bytes held in fragments
+    uint32_t bytes;
+    /// Length of the datagram payload, 0 until the last fragment is in
+    uint32_t length;
+    /// Time of the last fragment
+    Time updated;
+    /// Neighbours in update order
+    uint32_t prev, next;
+  };
+
+  /// Take an entry from the pool for key, evicting the oldest one if needed
+  uint32_t Allocate (const Key &key);
+  /// Drop the fragments of entry idx and put it back in the pool
+  void Release (uint32_t idx);
+  /// Release entry idx before completion
+  void Evict (uint32_t idx);
+  /// Make entry idx the most recently updated one
+  void Touch (uint32_t idx, Time now);
+  void Unlink (uint32_t idx);
+  /// Whether entry idx holds its whole payload
+  bool IsComplete (const Entry &entry) const;
+
+  std::vector<Entry> m_pool;
+  /// Entries not in use
+  std::vector<uint32_t> m_free;
+  /// Entries in use by datagram
+  std::map<Key, uint32_t> m_index;
+  /// Least and most recently updated entries
+  uint32_t m_oldest, m_newest;
+  uint32_t m_bytes;
+  uint32_t m_maxBytes;
+  Time m_timeout;
+  uint32_t m_hits;
+  uint32_t m_misses;
+  uint32_t m_evictions;
+};
+
+}
+}
+
+#endif /* LEACH_REASSEMBLY_CACHE_H */
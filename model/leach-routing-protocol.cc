@@ -39,20 +39,18 @@
 #include "ns3/boolean.h"
 #include "ns3/double.h"
 #include "ns3/uinteger.h"
+#include "ns3/enum.h"
 #include "ns3/vector.h"
 #include "ns3/udp-header.h"
+#include "ns3/udp-l4-protocol.h"
+#include "ns3/object-factory.h"
+#include "ns3/energy-source-container.h"
 
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <vector>
 
-//#define DA
-//#define DA_PROP
-//#define DA_OPT
-//#define DA_CL
-//#define DA_SF
-
-
 namespace ns3 {
 
 NS_LOG_COMPONENT_DEFINE ("LeachRoutingProtocol");
@@ -64,10 +62,6 @@ NS_OBJECT_ENSURE_REGISTERED (RoutingProtocol);
 /// UDP Port for LEACH control traffic
 const uint32_t RoutingProtocol::LEACH_PORT = 269;
 
-double max(double a, double b) {
-    return (a>b)?a:b;
-}
-  
 TypeId
 RoutingProtocol::GetTypeId (void)
 {
@@ -79,17 +73,133 @@ RoutingProtocol::GetTypeId (void)
                    TimeValue (Seconds (15)),
                    MakeTimeAccessor (&RoutingProtocol::m_periodicUpdateInterval),
                    MakeTimeChecker ())
+    .AddAttribute ("RouteHolddown", "How long a route of the round lasts without word from its next hop; "
+                   "cluster heads advertise again three times per holddown to keep the routes of their "
+                   "members up. Zero keeps routes for the whole round",
+                   TimeValue (Seconds (5)),
+                   MakeTimeAccessor (&RoutingProtocol::m_routeHolddown),
+                   MakeTimeChecker ())
     .AddAttribute ("Position", "X and Y position of the node",
                    Vector3DValue (),
                    MakeVectorAccessor (&RoutingProtocol::m_position),
                    MakeVectorChecker ())
-    .AddAttribute ("Lambda", "Average Packet generation rate",
+    .AddAttribute ("Lambda", "Average Packet generation rate, the prior of the rate estimated from the node's readings",
                    DoubleValue (1.0),
                    MakeDoubleAccessor (&RoutingProtocol::m_lambda),
                    MakeDoubleChecker <double>())
+    .AddAttribute ("RateEstimatorWeight", "Weight of the latest interval between readings in the rate estimate; 0 keeps Lambda",
+                   DoubleValue (0.125),
+                   MakeDoubleAccessor (&RoutingProtocol::SetRateEstimatorWeight,
+                                       &RoutingProtocol::GetRateEstimatorWeight),
+                   MakeDoubleChecker<double> (0, 1))
+    .AddAttribute ("AggregationPolicy", "The type of the data aggregation policy",
+                   TypeIdValue (NoAggregationPolicy::GetTypeId ()),
+                   MakeTypeIdAccessor (&RoutingProtocol::m_policyTypeId),
+                   MakeTypeIdChecker ())
+    .AddAttribute ("MaxAggregateSize", "Maximum size of an aggregate frame in bytes, UDP header excluded; "
+                   "also capped by the interface MTU",
+                   UintegerValue (1472),
+                   MakeUintegerAccessor (&RoutingProtocol::m_maxAggregateSize),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("SinkPort", "UDP port of the sink application, for frames the routing layer sends itself",
+                   UintegerValue (9),
+                   MakeUintegerAccessor (&RoutingProtocol::m_sinkPort),
+                   MakeUintegerChecker<uint16_t> ())
+    .AddAttribute ("AggregateFormat", "Encoding of the aggregate frames this node sends",
+                   EnumValue (AggregateHeader::COMPACT),
+                   MakeEnumAccessor (&RoutingProtocol::m_aggregateFormat),
+                   MakeEnumChecker (AggregateHeader::PLAIN, "Plain",
+                                    AggregateHeader::COMPACT, "Compact"))
+    .AddAttribute ("Election", "How a node decides to become cluster head: with the Classic LEACH threshold, "
+                   "with the threshold weighted by the remaining Energy of its energy sources, "
+                   "or Centralized as in LEACH-C, where the sink assigns the heads from the position "
+                   "and energy every node reports",
+                   EnumValue (RoutingProtocol::CLASSIC),
+                   MakeEnumAccessor (&RoutingProtocol::m_election),
+                   MakeEnumChecker (RoutingProtocol::CLASSIC, "Classic",
+                                    RoutingProtocol::ENERGY, "Energy",
+                                    RoutingProtocol::CENTRALIZED, "Centralized"))
+    .AddAttribute ("HeadRouting", "How cluster heads reach the sink: Direct, or through an Overlay of cluster heads "
+                   "closer to the sink, minimizing the sum of squared hop distances over the next two hops",
+                   EnumValue (RoutingProtocol::DIRECT),
+                   MakeEnumAccessor (&RoutingProtocol::m_headRouting),
+                   MakeEnumChecker (RoutingProtocol::DIRECT, "Direct",
+                                    RoutingProtocol::OVERLAY, "Overlay"))
+    .AddAttribute ("SinkPosition", "Position of the sink, for the Overlay head routing, until its beacon arrives",
+                   Vector3DValue (),
+                   MakeVectorAccessor (&RoutingProtocol::m_sinkPosition),
+                   MakeVectorChecker ())
+    .AddAttribute ("ClusterCount", "With Centralized election, number of clusters the sink forms; "
+                   "0 for a tenth of the reporting nodes",
+                   UintegerValue (0),
+                   MakeUintegerAccessor (&RoutingProtocol::m_clusterCount),
+                   MakeUintegerChecker<uint32_t> (0, 255))
+    .AddAttribute ("ReportWindow", "With Centralized election, how long the sink collects reports "
+                   "after the first of a round",
+                   TimeValue (MilliSeconds (50)),
+                   MakeTimeAccessor (&RoutingProtocol::m_reportWindow),
+                   MakeTimeChecker ())
+    .AddAttribute ("SlotDuration", "TDMA slot of each cluster member, which holds its readings until "
+                   "its slot comes; zero to contend for the channel instead",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&RoutingProtocol::m_slotDuration),
+                   MakeTimeChecker ())
+    .AddAttribute ("StopTime", "Time the simulation stops; zero if unknown, in which case only Drain () drains",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&RoutingProtocol::m_stopTime),
+                   MakeTimeChecker ())
+    .AddAttribute ("DrainLead", "How long before StopTime buffered readings stop waiting and go to the sink",
+                   TimeValue (Seconds (1.5)),
+                   MakeTimeAccessor (&RoutingProtocol::m_drainLead),
+                   MakeTimeChecker ())
+    .AddAttribute ("FlushGuard", "How long before the earliest buffered deadline the buffer is sent, "
+                   "if no new reading made the policy send it earlier",
+                   TimeValue (MilliSeconds (100)),
+                   MakeTimeAccessor (&RoutingProtocol::m_flushGuard),
+                   MakeTimeChecker ())
+    .AddAttribute ("DeferredInterval", "Time between route lookups for packets waiting without aggregation",
+                   TimeValue (MilliSeconds (100)),
+                   MakeTimeAccessor (&RoutingProtocol::m_deferredInterval),
+                   MakeTimeChecker ())
+    .AddAttribute ("DeferredRetries", "Number of failed route lookups after which a waiting packet is dropped",
+                   UintegerValue (50),
+                   MakeUintegerAccessor (&RoutingProtocol::m_deferredRetries),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("DeferredQueueLength", "Maximum number of packets waiting for a route without aggregation",
+                   UintegerValue (256),
+                   MakeUintegerAccessor (&RoutingProtocol::SetDeferredQueueLength,
+                                         &RoutingProtocol::GetDeferredQueueLength),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("ReassemblyEntries", "Maximum number of datagrams reassembled at once",
+                   UintegerValue (16),
+                   MakeUintegerAccessor (&RoutingProtocol::SetReassemblyEntries,
+                                         &RoutingProtocol::GetReassemblyEntries),
+                   MakeUintegerChecker<uint32_t> (1))
+    .AddAttribute ("ReassemblyMaxBytes", "Maximum number of bytes held in fragments being reassembled",
+                   UintegerValue (65536),
+                   MakeUintegerAccessor (&RoutingProtocol::SetReassemblyMaxBytes,
+                                         &RoutingProtocol::GetReassemblyMaxBytes),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("ReassemblyTimeout", "Time after its last fragment a partial datagram is dropped",
+                   TimeValue (Seconds (3)),
+                   MakeTimeAccessor (&RoutingProtocol::SetReassemblyTimeout,
+                                     &RoutingProtocol::GetReassemblyTimeout),
+                   MakeTimeChecker ())
     .AddTraceSource ("DroppedCount", "Total packets dropped",
                    MakeTraceSourceAccessor (&RoutingProtocol::m_dropped),
                    "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("SuppressedCount", "Total readings dropped as redundant by the policy",
+                   MakeTraceSourceAccessor (&RoutingProtocol::m_suppressed),
+                   "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("ForwardedCount", "Total received readings the policy buffered for the sink",
+                   MakeTraceSourceAccessor (&RoutingProtocol::m_forwarded),
+                   "ns3::TracedValueCallback::Uint32")
+    .AddTraceSource ("Timeline", "A reading was sent or buffered, with its deadline",
+                   MakeTraceSourceAccessor (&RoutingProtocol::m_timelineTrace),
+                   "ns3::leach::RoutingProtocol::TimelineTracedCallback")
+    .AddTraceSource ("TxTime", "A frame was sent to the sink",
+                   MakeTraceSourceAccessor (&RoutingProtocol::m_txTimeTrace),
+                   "ns3::leach::RoutingProtocol::TxTimeTracedCallback")
     ;
   return tid;
 }
@@ -104,15 +214,65 @@ RoutingProtocol::GetPosition () const
 {
   return m_position;
 }
-std::vector<struct msmt>*
-RoutingProtocol::getTimeline()
+void
+RoutingProtocol::SetRateEstimatorWeight (double weight)
+{
+  m_arrivals.SetWeight (weight);
+}
+double
+RoutingProtocol::GetRateEstimatorWeight () const
+{
+  return m_arrivals.GetWeight ();
+}
+double
+RoutingProtocol::GetArrivalRate () const
 {
-  return &timeline;
+  return m_arrivals.GetRate ();
 }
-std::vector<Time>*
-RoutingProtocol::getTxTime()
+void
+RoutingProtocol::SetDeferredQueueLength (uint32_t len)
+{
+  m_deferredQueue.SetMaxQueueLen (len);
+}
+uint32_t
+RoutingProtocol::GetDeferredQueueLength () const
+{
+  return m_deferredQueue.GetMaxQueueLen ();
+}
+void
+RoutingProtocol::SetReassemblyEntries (uint32_t n)
 {
-  return &tx_time;
+  m_reassembly.SetMaxEntries (n);
+}
+uint32_t
+RoutingProtocol::GetReassemblyEntries () const
+{
+  return m_reassembly.GetMaxEntries ();
+}
+void
+RoutingProtocol::SetReassemblyMaxBytes (uint32_t bytes)
+{
+  m_reassembly.SetMaxBytes (bytes);
+}
+uint32_t
+RoutingProtocol::GetReassemblyMaxBytes () const
+{
+  return m_reassembly.GetMaxBytes ();
+}
+void
+RoutingProtocol::SetReassemblyTimeout (Time t)
+{
+  m_reassembly.SetTimeout (t);
+}
+Time
+RoutingProtocol::GetReassemblyTimeout () const
+{
+  return m_reassembly.GetTimeout ();
+}
+const ReassemblyCache &
+RoutingProtocol::GetReassemblyCache () const
+{
+  return m_reassembly;
 }
   
 int64_t
@@ -127,18 +287,44 @@ RoutingProtocol::RoutingProtocol ()
   : Round(0),
     isSink(0),
     m_dropped (0),
+    m_suppressed (0),
+    m_forwarded (0),
     m_lambda (4.0),
-	timeline(),
-	tx_time(),
+    m_maxAggregateSize (1472),
+    m_sinkPort (9),
+    m_aggregateFormat (AggregateHeader::COMPACT),
+    m_draining (false),
+    m_election (CLASSIC),
+    m_roundsAsMember (0),
+    m_clusterCount (0),
+    m_headRouting (DIRECT),
+    m_headCost (0),
+    m_holding (false),
     m_routingTable (),
     m_bestRoute(),
     m_queue (),
+    m_reassembly (),
     m_periodicUpdateTimer (Timer::CANCEL_ON_DESTROY),
     m_broadcastClusterHeadTimer (Timer::CANCEL_ON_DESTROY),
-    m_respondToClusterHeadTimer (Timer::CANCEL_ON_DESTROY)
+    m_respondToClusterHeadTimer (Timer::CANCEL_ON_DESTROY),
+    m_deferredTimer (Timer::CANCEL_ON_DESTROY),
+    m_drainTimer (Timer::CANCEL_ON_DESTROY),
+    m_flushTimer (Timer::CANCEL_ON_DESTROY),
+    m_reportTimer (Timer::CANCEL_ON_DESTROY),
+    m_assignTimer (Timer::CANCEL_ON_DESTROY),
+    m_scheduleTimer (Timer::CANCEL_ON_DESTROY),
+    m_beaconTimer (Timer::CANCEL_ON_DESTROY),
+    m_slotTimer (Timer::CANCEL_ON_DESTROY)
 {
   m_uniformRandomVariable = CreateObject<UniformRandomVariable> ();
-  for(int i=0; i<1021; i++) m_hash[i] = NULL;
+  m_deferredTimer.SetFunction (&RoutingProtocol::AutoDequeueNoDA,this);
+  m_flushTimer.SetFunction (&RoutingProtocol::FlushDue,this);
+  m_reportTimer.SetFunction (&RoutingProtocol::SendReport,this);
+  m_assignTimer.SetFunction (&RoutingProtocol::SendAssignment,this);
+  m_scheduleTimer.SetFunction (&RoutingProtocol::SendSchedule,this);
+  m_slotTimer.SetFunction (&RoutingProtocol::SlotBoundary,this);
+  m_beaconTimer.SetFunction (&RoutingProtocol::SendSinkBeacon,this);
+  m_routingTable.SetExpireCallback (MakeCallback (&RoutingProtocol::RouteExpired, this));
 }
 
 RoutingProtocol::~RoutingProtocol ()
@@ -148,13 +334,19 @@ RoutingProtocol::~RoutingProtocol ()
 void
 RoutingProtocol::DoDispose ()
 {
+  NS_LOG_INFO ("Reassembly hits " << m_reassembly.GetHits ()
+               << ", misses " << m_reassembly.GetMisses ()
+               << ", evictions " << m_reassembly.GetEvictions ());
   m_ipv4 = 0;
+  m_policy = 0;
   for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::iterator iter = m_socketAddresses.begin (); iter
        != m_socketAddresses.end (); iter++)
     {
       iter->first->Close ();
     }
   m_socketAddresses.clear ();
+  m_addressSockets.clear ();
+  m_interfaceAddresses.clear ();
   Ipv4RoutingProtocol::DoDispose ();
 }
 
@@ -178,12 +370,24 @@ RoutingProtocol::Start ()
   m_sinkAddress = Ipv4Address("10.1.1.1");
   ns3::PacketMetadata::Enable ();
   ns3::Packet::EnablePrinting ();
+
+  ObjectFactory factory;
+  factory.SetTypeId (m_policyTypeId);
+  m_policy = factory.Create<AggregationPolicy> ();
+  m_arrivals.SetPrior (m_lambda);
+  if (!m_stopTime.IsZero ())
+    {
+      Time drain = m_stopTime - m_drainLead - Simulator::Now ();
+      m_drainTimer.SetFunction (&RoutingProtocol::Drain,this);
+      m_drainTimer.Schedule (drain.IsStrictlyPositive () ? drain : Seconds (0));
+    }
   
   if(m_mainAddress == m_sinkAddress) {
     isSink = 1;
+    m_beaconTimer.Schedule (Seconds (0));
   } else {
     Round = 0;
-    m_routingTable.Setholddowntime (Time (m_periodicUpdateInterval));
+    m_routingTable.Setholddowntime (m_routeHolddown);
     m_periodicUpdateTimer.SetFunction (&RoutingProtocol::PeriodicUpdate,this);
     m_broadcastClusterHeadTimer.SetFunction (&RoutingProtocol::SendBroadcast,this);
     m_respondToClusterHeadTimer.SetFunction(&RoutingProtocol::RespondToClusterHead, this);
@@ -208,56 +412,105 @@ RoutingProtocol::RouteOutput (Ptr<Packet> p,
     }
 
   Ipv4Address dst = header.GetDestination ();
-  RoutingTableEntry rt;
   NS_LOG_DEBUG ("Packet Size: " << p->GetSize ()
                                 << ", Packet id: " << p->GetUid () << ", Destination address in Packet: " << dst);
-#ifdef DA
-  if (p->GetSize()%56 == 0)
+  // Everything but control messages sent to the sink is a reading, and
+  // leaves in a frame
+  LeachControlTag control;
+  bool data = (p != 0 && dst == m_sinkAddress && !p->PeekPacketTag (control));
+  Time deadline;
+  if (data)
     {
-/*
-      if (p->GetSize() == 56)
-	    {
-          Ptr<Packet> packet = new Packet(*p);
-          LeachHeader hdr;
-          struct ns3::leach::msmt tmp;
-          
-          packet->RemoveHeader(hdr);
-          tmp.begin = Simulator::Now();
-          tmp.end = hdr.GetDeadline();
-          timeline.push_back(tmp);
-		}
-*/
-      if (DataAggregation (p))
+      deadline = LeachHeader::PeekDeadline (p);
+      m_arrivals.Update (Simulator::Now ());
+      StampReading (p);
+      if (!DataAggregation (p, deadline))
         {
-#endif
-          if (m_routingTable.LookupRoute (dst,rt))
-            {
-              tx_time.push_back(Simulator::Now());
-				
-              Ptr<Packet> packet = new Packet(*p);
-              LeachHeader hdr;
-              struct ns3::leach::msmt tmp;
-          
-              packet->RemoveHeader(hdr);
-              tmp.begin = Simulator::Now();
-              tmp.end = hdr.GetDeadline();
-              timeline.push_back(tmp);
-				
-              return rt.GetRoute();
-            }
-#ifdef DA
+          return GetSinkLoopback (header,oif);
         }
+      // DataAggregation only sends with a route to the sink
+      Ptr<Ipv4Route> route = GetSinkRoute ();
+      NS_ASSERT (route != 0);
+      m_txTimeTrace (Simulator::Now ());
+      m_timelineTrace (Simulator::Now (), deadline);
+      return route;
+    }
+  // Control messages; readings are traced as they leave in frames
+  if (dst == m_sinkAddress)
+    {
+      // Straight to the sink, which LEACH assumes in range
+      int32_t interface = m_ipv4->GetInterfaceForAddress (m_mainAddress);
+      NS_ASSERT (interface >= 0);
+      Ptr<Ipv4Route> route = Create<Ipv4Route> ();
+      route->SetDestination (m_sinkAddress);
+      route->SetGateway (m_sinkAddress);
+      route->SetSource (m_mainAddress);
+      route->SetOutputDevice (oif ? oif : m_ipv4->GetNetDevice (interface));
+      return route;
     }
-  else if (m_routingTable.LookupRoute (dst,rt))
+  const RoutingTableEntry *rt = m_routingTable.LookupRoute (dst);
+  if (rt != 0)
     {
-//      tx_time.push_back(Simulator::Now());
-      return rt.GetRoute();
+      return rt->GetRoute ();
     }
-#endif
 
   return LoopbackRoute (header,oif);
 }
 
+Ptr<Ipv4Route>
+RoutingProtocol::GetSinkRoute ()
+{
+  if (m_sinkRoute == 0)
+    {
+      const RoutingTableEntry *rt = m_routingTable.LookupRoute (m_sinkAddress);
+      if (rt != 0)
+        {
+          m_sinkRoute = rt->GetRoute ();
+        }
+    }
+  return m_sinkRoute;
+}
+
+void
+RoutingProtocol::InvalidateSinkRoute ()
+{
+  m_sinkRoute = 0;
+  m_sinkLoopback = 0;
+}
+
+void
+RoutingProtocol::RouteExpired (Ipv4Address dst)
+{
+  NS_LOG_DEBUG (m_mainAddress << " heard nothing from the next hop to " << dst);
+  if (dst != m_sinkAddress)
+    {
+      // The route to the sink shares the next hop, and expires with it
+      return;
+    }
+  // Readings are buffered again until a route comes back
+  InvalidateSinkRoute ();
+  if (cluster_head_this_round && m_headNextHop != m_sinkAddress)
+    {
+      // The overlay next hop went quiet, reach the sink directly
+      m_headNextHop = m_sinkAddress;
+      m_headCost = std::pow (CalculateDistance (m_position, m_sinkPosition), 2);
+      InstallHeadRoute (FindSocketWithAddress (m_mainAddress)->GetBoundNetDevice (),
+                        m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (m_mainAddress), 0));
+    }
+}
+
+Ptr<Ipv4Route>
+RoutingProtocol::GetSinkLoopback (const Ipv4Header &header, Ptr<NetDevice> oif)
+{
+  // Buffered readings all loop back the same way
+  if (m_sinkLoopback == 0 || m_sinkLoopbackOif != oif)
+    {
+      m_sinkLoopback = LoopbackRoute (header,oif);
+      m_sinkLoopbackOif = oif;
+    }
+  return m_sinkLoopback;
+}
+
 Ptr<Ipv4Route>
 RoutingProtocol::LoopbackRoute (const Ipv4Header & hdr, Ptr<NetDevice> oif) const
 {
@@ -346,11 +599,12 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p,
   if (idev == m_lo)
     {
       NS_LOG_DEBUG("LoopBackRoute");
-#ifdef DA
-      Ptr<Packet> pa = new Packet(*p);
-      EnqueuePacket (pa,header);
-      return false;
-#else
+      if (m_policy->IsAggregating () || HoldForSlot ())
+        {
+          Ptr<Packet> pa = new Packet(*p);
+          EnqueuePacket (pa,header);
+          return false;
+        }
       RoutingTableEntry toDst;
       NS_LOG_DEBUG("Deferred: " << dst);
       
@@ -364,33 +618,19 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p,
       else
         {
           NS_LOG_DEBUG("Route not found");
-          
-          Ptr<Ipv4Route> rt = Create<Ipv4Route> ();
-          rt->SetDestination (dst);
-          rt->SetSource (origin);
-          rt->SetGateway (Ipv4Address ("127.0.0.1"));
-          rt->SetOutputDevice (m_lo);
-          
-          EnqueueForNoDA(ucb, rt, p, header);
+          EnqueueForNoDA(ucb, p, header);
         }
       return true;
-#endif
     }
-  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j =
-         m_socketAddresses.begin (); j != m_socketAddresses.end (); ++j)
+  if (m_addressSockets.find (origin) != m_addressSockets.end ())
     {
-      Ipv4InterfaceAddress iface = j->second;
-      if (origin == iface.GetLocal ())
-        {
-          return true;
-        }
+      return true;
     }
   // LOCAL DELIVARY TO LEACH INTERFACES
-  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddresses.begin (); j
-       != m_socketAddresses.end (); ++j)
+  if (static_cast<uint32_t> (iif) < m_interfaceAddresses.size ())
     {
-      Ipv4InterfaceAddress iface = j->second;
-      if (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()) == iif)
+      Ipv4InterfaceAddress iface = m_interfaceAddresses[iif];
+      if (iface.GetLocal () != Ipv4Address ())
         {
           // Do not deal with broadcast
           if (dst == iface.GetBroadcast () || dst.IsBroadcast ())
@@ -463,55 +703,75 @@ RoutingProtocol::RouteInput (Ptr<const Packet> p,
                                       << " from " << header.GetSource ()
                                       << " via nexthop neighbor " << toDst.GetNextHop ());
 
-#ifdef DA
-          Ptr<Packet> pa = new Packet(*p);
-          EnqueuePacket(pa, header);
-          return false;
-#else
+          if (m_policy->IsAggregating ())
+            {
+              Ptr<Packet> pa = new Packet(*p);
+              EnqueuePacket(pa, header);
+              return false;
+            }
           ucb (route,p,header);
           return true;
-#endif
         }
     }
     /*
   NS_LOG_LOGIC ("Drop packet " << p->GetUid ()
                                << " as there is no route to forward it.");
     */
-#ifndef DA
-  NS_LOG_DEBUG("Route not found");
-  
-  Ptr<Ipv4Route> rt = Create<Ipv4Route> ();
-  rt->SetDestination (dst);
-  rt->SetSource (origin);
-  rt->SetGateway (Ipv4Address ("127.0.0.1"));
-  rt->SetOutputDevice (m_lo);
-  
-  EnqueueForNoDA(ucb, rt, p, header);
-#endif
+  if (!m_policy->IsAggregating ())
+    {
+      NS_LOG_DEBUG("Route not found");
+      EnqueueForNoDA(ucb, p, header);
+    }
   return false;
 }
 
 void
-RoutingProtocol::EnqueueForNoDA(UnicastForwardCallback ucb, Ptr<Ipv4Route> rt, Ptr<const Packet> p, const Ipv4Header &header)
-{
-  struct DeferredPack tmp;
-  tmp.ucb = ucb;
-  tmp.rt = rt;
-  tmp.p = p;
-  tmp.header = header;
-  DeferredQueue.push_back(tmp);
-  
-  Simulator::Schedule (MilliSeconds (100),&RoutingProtocol::AutoDequeueNoDA,this);
+RoutingProtocol::EnqueueForNoDA(UnicastForwardCallback ucb, Ptr<const Packet> p, const Ipv4Header &header)
+{
+  DeferredQueue::Entry entry;
+  entry.ucb = ucb;
+  entry.packet = p;
+  entry.header = header;
+  entry.retries = 0;
+  if (!m_deferredQueue.Enqueue (entry))
+    {
+      m_dropped++;
+    }
+  // One timer serves the whole queue
+  if (!m_deferredTimer.IsRunning ())
+    {
+      m_deferredTimer.Schedule (m_deferredInterval);
+    }
 }
   
 void
 RoutingProtocol::AutoDequeueNoDA()
 {
-  while(DeferredQueue.size())
+  // Entries without a route go to the back, after the ones present now
+  uint32_t n = m_deferredQueue.GetSize ();
+  for (uint32_t i = 0; i < n; i++)
     {
-      struct DeferredPack tmp = DeferredQueue.front();
-      tmp.ucb(tmp.rt, tmp.p, tmp.header);
-      DeferredQueue.erase(DeferredQueue.begin());
+      DeferredQueue::Entry entry = m_deferredQueue.Front ();
+      m_deferredQueue.Pop ();
+      RoutingTableEntry toDst;
+      if (m_routingTable.LookupRoute (entry.header.GetDestination (),toDst))
+        {
+          NS_LOG_DEBUG("Deferred forwarding to " << toDst.GetNextHop());
+          entry.ucb (toDst.GetRoute (), entry.packet, entry.header);
+        }
+      else if (++entry.retries < m_deferredRetries)
+        {
+          m_deferredQueue.Enqueue (entry);
+        }
+      else
+        {
+          NS_LOG_DEBUG("Drop packet " << entry.packet->GetUid () << " after " << entry.retries << " retries");
+          m_dropped++;
+        }
+    }
+  if (!m_deferredQueue.IsEmpty ())
+    {
+      m_deferredTimer.Schedule (m_deferredInterval);
     }
 }
   
@@ -523,46 +783,102 @@ RoutingProtocol::RecvLeach (Ptr<Socket> socket)
   InetSocketAddress inetSourceAddr = InetSocketAddress::ConvertFrom (sourceAddress);
   Ipv4Address sender = inetSourceAddr.GetIpv4 ();
   Ipv4Address receiver = m_socketAddresses[socket].GetLocal ();
+  LeachControlHeader control;
+  packet->RemoveHeader (control);
+  if (!control.IsValid ())
+    {
+      NS_LOG_DEBUG ("Drop unknown control message from " << sender);
+      return;
+    }
+
+  switch (control.GetType ())
+    {
+    case LeachControlHeader::SINK_BEACON:
+      m_sinkPosition = control.GetPosition ();
+      break;
+    case LeachControlHeader::REPORT:
+      if (isSink)
+        {
+          RecvReport (packet, sender);
+        }
+      break;
+    case LeachControlHeader::ASSIGNMENT:
+      if (!isSink)
+        {
+          RecvAssignment (packet, socket, receiver);
+        }
+      break;
+    case LeachControlHeader::ADV:
+      if (!isSink)
+        {
+          RecvAdvertisement (control.GetPosition (), sender, socket, receiver);
+        }
+      break;
+    case LeachControlHeader::JOIN:
+      if (cluster_head_this_round)
+        {
+          // Record cluster member
+          m_clusterMember.push_back (sender);
+        }
+      break;
+    case LeachControlHeader::SCHEDULE:
+      RecvSchedule (packet, sender);
+      break;
+    }
+}
+
+void
+RoutingProtocol::RecvAdvertisement (Vector senderPosition, Ipv4Address sender,
+                                    Ptr<Socket> socket, Ipv4Address receiver)
+{
   double dist, dx, dy;
-  LeachHeader leachHeader;
-  Vector senderPosition;
-  
   // maintain list of received advertisements
   // always choose the closest CH to join in
   // if itself is CH, pass this phase
-  packet->RemoveHeader(leachHeader);
-  
-  /*
-  NS_LOG_DEBUG(leachHeader.GetAddress());
-  NS_LOG_DEBUG(isSink);
-  NS_LOG_DEBUG(m_mainAddress);
-  */
-  
-  if(isSink) return;
-  if(leachHeader.GetAddress() == Ipv4Address("255.255.255.255")) {
-      NS_LOG_DEBUG("Recv broadcast from CH: " << sender);
-    // Need to update a new route
-    RoutingTableEntry newEntry (
-      /*device=*/ socket->GetBoundNetDevice(), /*dst (sink)*/m_sinkAddress,
-      /*iface=*/ m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0),
-      /*next hop=*/ sender);
-    
-    senderPosition = leachHeader.GetPosition();
-    dx = senderPosition.x - m_position.x;
-    dy = senderPosition.y - m_position.y;
-    dist = dx*dx + dy*dy;
-    NS_LOG_DEBUG("dist = " << dist << ", m_dist = " << m_dist);
-    
-    if(dist < m_dist) {
-      m_dist = dist;
-      m_targetAddress = sender;
-      m_bestRoute = newEntry;
-      NS_LOG_DEBUG(sender);
+  NS_LOG_DEBUG("Recv broadcast from CH: " << sender);
+  if (cluster_head_this_round) {
+    // Cluster heads join no one, but may route through the sender
+    if (m_headRouting == OVERLAY) {
+      ConsiderHeadRoute (sender, senderPosition, socket, receiver);
     }
-  }else {
-    // Record cluster member
-    m_clusterMember.push_back(leachHeader.GetAddress());
+    return;
   }
+  if (!m_respondToClusterHeadTimer.IsRunning ()) {
+    // Past the join phase, the advertisements of our head keep its routes up
+    if (sender == m_targetAddress) {
+      m_routingTable.Touch (m_sinkAddress);
+      m_routingTable.Touch (sender);
+    }
+    return;
+  }
+  dx = senderPosition.x - m_position.x;
+  dy = senderPosition.y - m_position.y;
+  dist = dx*dx + dy*dy;
+  NS_LOG_DEBUG("dist = " << dist << ", m_dist = " << m_dist);
+
+  if(dist < m_dist) {
+    m_dist = dist;
+    m_targetAddress = sender;
+    // Update the candidate route in place
+    Ipv4InterfaceAddress iface = m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0);
+    m_bestRoute.SetInterface (iface);
+    m_bestRoute.GetRoute ()->SetDestination (m_sinkAddress);
+    m_bestRoute.GetRoute ()->SetSource (iface.GetLocal ());
+    m_bestRoute.SetNextHop (sender);
+    m_bestRoute.SetOutputDevice (socket->GetBoundNetDevice ());
+    NS_LOG_DEBUG(sender);
+  }
+}
+
+void
+RoutingProtocol::SendSinkBeacon ()
+{
+  Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (LeachControlHeader (LeachControlHeader::SINK_BEACON, m_position));
+  socket->SetAllowBroadcast (true);
+  socket->SendTo (packet, 0, InetSocketAddress (Ipv4Address ("10.1.1.255"), LEACH_PORT));
+  m_beaconTimer.Schedule (m_periodicUpdateInterval);
 }
 
 void
@@ -570,27 +886,24 @@ RoutingProtocol::RespondToClusterHead()
 {
   Ptr<Socket> socket = FindSocketWithAddress(m_mainAddress);
   Ptr<Packet> packet = Create<Packet> ();
-  LeachHeader leachHeader;
   Ipv4Address ipv4;
   OutputStreamWrapper temp = OutputStreamWrapper(&std::cout);
 
   
   // Add routing to routingTable
+  InvalidateSinkRoute ();
   if(m_targetAddress != ipv4) {
-    RoutingTableEntry newEntry, entry2;
-    newEntry.Copy(m_bestRoute);
-    entry2.Copy(m_bestRoute);
-    Ptr<Ipv4Route> newRoute = newEntry.GetRoute();
-    newRoute->SetDestination(m_targetAddress);
-    newEntry.SetRoute(newRoute);
-
-    if(m_bestRoute.GetInterface().GetLocal() != ipv4) m_routingTable.AddRoute (entry2);
-    if(newEntry.GetInterface().GetLocal() != ipv4) m_routingTable.AddRoute (newEntry);
+    // Routes to the sink and to the cluster head, both through the cluster head
+    if(m_bestRoute.GetInterface().GetLocal() != ipv4) {
+      m_routingTable.RefreshRoute (m_bestRoute.GetOutputDevice (), m_sinkAddress,
+                                   m_bestRoute.GetInterface (), m_bestRoute.GetNextHop ());
+      m_routingTable.RefreshRoute (m_bestRoute.GetOutputDevice (), m_targetAddress,
+                                   m_bestRoute.GetInterface (), m_bestRoute.GetNextHop ());
+    }
 
 //    m_routingTable.Print(&temp);
       
-    leachHeader.SetAddress(m_mainAddress);
-    packet->AddHeader (leachHeader);
+    packet->AddHeader (LeachControlHeader (LeachControlHeader::JOIN));
     socket->SendTo (packet, 0, InetSocketAddress (m_targetAddress, LEACH_PORT));
   }
 }
@@ -600,20 +913,65 @@ RoutingProtocol::SendBroadcast ()
 {
   Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
   Ptr<Packet> packet = Create<Packet> ();
-  LeachHeader leachHeader;
   Ipv4Address destination = Ipv4Address ("10.1.1.255");;
 
   socket->SetAllowBroadcast (true);
 
-  leachHeader.SetPosition (m_position);
-  packet->AddHeader (leachHeader);
+  packet->AddHeader (LeachControlHeader (LeachControlHeader::ADV, m_position));
   socket->SendTo (packet, 0, InetSocketAddress (destination, LEACH_PORT));
   
-  RoutingTableEntry newEntry (
-      /*device=*/ socket->GetBoundNetDevice(), /*dst (sink)*/m_sinkAddress,
-      /*iface=*/ m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (m_mainAddress), 0),
-      /*next hop=*/ m_sinkAddress);
-  m_routingTable.AddRoute (newEntry);
+  // A direct route lives on our own advertisements, an overlay route on
+  // those of the next hop
+  if (m_headNextHop == m_sinkAddress && !m_routingTable.Touch (m_sinkAddress))
+    {
+      InstallHeadRoute (socket->GetBoundNetDevice (),
+                        m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (m_mainAddress), 0));
+    }
+  if (m_routeHolddown.IsStrictlyPositive ())
+    {
+      m_broadcastClusterHeadTimer.Schedule (MicroSeconds (m_routeHolddown.GetMicroSeconds () / 3));
+    }
+}
+
+void
+RoutingProtocol::InstallHeadRoute (Ptr<NetDevice> dev, Ipv4InterfaceAddress iface)
+{
+  m_routingTable.RefreshRoute (dev, m_sinkAddress, iface, m_headNextHop);
+  if (m_headNextHop != m_sinkAddress)
+    {
+      // Forwarding looks up the next hop as well
+      m_routingTable.RefreshRoute (dev, m_headNextHop, iface, m_headNextHop);
+    }
+  InvalidateSinkRoute ();
+}
+
+void
+RoutingProtocol::ConsiderHeadRoute (Ipv4Address head, Vector position,
+                                    Ptr<Socket> socket, Ipv4Address receiver)
+{
+  if (head == m_headNextHop)
+    {
+      m_routingTable.Touch (m_sinkAddress);
+      m_routingTable.Touch (head);
+      return;
+    }
+  double toSink = CalculateDistance (position, m_sinkPosition);
+  // Only heads closer to the sink, so that the overlay has no loops
+  if (toSink >= CalculateDistance (m_position, m_sinkPosition))
+    {
+      return;
+    }
+  double hop = CalculateDistance (m_position, position);
+  double cost = hop * hop + toSink * toSink;
+  if (cost >= m_headCost)
+    {
+      return;
+    }
+  NS_LOG_DEBUG (m_mainAddress << " reaches the sink through " << head << ", cost " << cost);
+  m_headNextHop = head;
+  m_headCost = cost;
+  InstallHeadRoute (socket->GetBoundNetDevice (),
+                    m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0));
 }
   
 void
@@ -624,12 +982,20 @@ RoutingProtocol::PeriodicUpdate ()
   int n = 10;
   double p = 1.0/n;
   double t = p/(1-p*(Round%n));
+  if (m_election == ENERGY)
+    {
+      // Weight by the remaining energy, but let a node back in as it stays
+      // member, at the classic threshold after a whole cycle, so that
+      // depleted fields keep electing
+      t *= GetEnergyWeight (GetEnergyFraction (), m_roundsAsMember, n);
+    }
   
   NS_LOG_DEBUG("PeriodicUpdate!!");
 //  NS_LOG_DEBUG("prob = " << prob << ", t = " << t);
 
-  m_routingTable.DeleteRoute(m_targetAddress);
-  m_routingTable.DeleteRoute(m_sinkAddress);
+  // Routes of the last round go stale, and are refreshed in place
+  m_routingTable.NewEpoch ();
+  InvalidateSinkRoute ();
 /*
   OutputStreamWrapper temp = OutputStreamWrapper(&std::cout);
   m_routingTable.Print(&temp);
@@ -641,21 +1007,241 @@ RoutingProtocol::PeriodicUpdate ()
   m_clusterMember.clear();
   m_bestRoute.Reset();
   m_targetAddress = Ipv4Address();
+  m_headNextHop = m_sinkAddress;
+  m_headCost = std::pow (CalculateDistance (m_position, m_sinkPosition), 2);
+  // Contend for the channel until the new cluster head sends its schedule
+  m_scheduleTimer.Cancel ();
+  m_slotTimer.Cancel ();
+  m_broadcastClusterHeadTimer.Cancel ();
+  m_holding = false;
+  ScheduleFlush ();
   
-  if(prob < t && valid) {
+  if (m_election == CENTRALIZED) {
+    // The sink elects the cluster heads from the reports
+    m_reportTimer.Schedule (MicroSeconds (m_uniformRandomVariable->GetInteger (0,10000)));
+  }else if(prob < t && valid) {
     // become cluster head
     // broadcast info
     NS_LOG_DEBUG(m_mainAddress << " becomes cluster head");
     valid = 0;
     cluster_head_this_round = 1;
+    m_roundsAsMember = 0;
     m_targetAddress = m_sinkAddress;
     m_broadcastClusterHeadTimer.Schedule (MicroSeconds (m_uniformRandomVariable->GetInteger (10000,50000)));
+    if (m_slotDuration.IsStrictlyPositive ()) {
+      // Members join 100 ms into the round
+      m_scheduleTimer.Schedule (MilliSeconds (150));
+    }
   }else {
+    m_roundsAsMember++;
     m_respondToClusterHeadTimer.Schedule (MilliSeconds(100) + MicroSeconds (m_uniformRandomVariable->GetInteger (0,1000)));
   }
   m_periodicUpdateTimer.Schedule (m_periodicUpdateInterval + MicroSeconds (m_uniformRandomVariable->GetInteger (0,1000)));
 }
 
+double
+RoutingProtocol::GetEnergyWeight (double fraction, uint32_t roundsAsMember, uint32_t cycle)
+{
+  double back = std::min (1.0, double (roundsAsMember) / cycle);
+  return fraction + back * (1 - fraction);
+}
+
+double
+RoutingProtocol::GetEnergyFraction () const
+{
+  Ptr<EnergySourceContainer> sources = GetObject<Node> ()->GetObject<EnergySourceContainer> ();
+  if (sources == 0)
+    {
+      return 1;
+    }
+  double remaining = 0, initial = 0;
+  for (EnergySourceContainer::Iterator i = sources->Begin (); i != sources->End (); ++i)
+    {
+      remaining += (*i)->GetRemainingEnergy ();
+      initial += (*i)->GetInitialEnergy ();
+    }
+  if (initial <= 0)
+    {
+      return 1;
+    }
+  return std::max (0.0, std::min (1.0, remaining / initial));
+}
+
+void
+RoutingProtocol::SendReport ()
+{
+  Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (ClusterReportHeader (m_position, GetEnergyFraction ()));
+  packet->AddHeader (LeachControlHeader (LeachControlHeader::REPORT));
+  // Bound to the sink, but no reading
+  packet->AddPacketTag (LeachControlTag ());
+  socket->SendTo (packet, 0, InetSocketAddress (m_sinkAddress, LEACH_PORT));
+}
+
+void
+RoutingProtocol::RecvReport (Ptr<Packet> packet, Ipv4Address sender)
+{
+  ClusterReportHeader report;
+  packet->RemoveHeader (report);
+  NS_LOG_DEBUG ("Report from " << sender << ", energy " << report.GetEnergy ());
+  m_partition.Add (sender, report.GetPosition (), report.GetEnergy ());
+  if (!m_assignTimer.IsRunning ())
+    {
+      m_assignTimer.Schedule (m_reportWindow);
+    }
+}
+
+void
+RoutingProtocol::SendAssignment ()
+{
+  uint32_t k = m_clusterCount;
+  if (k == 0)
+    {
+      k = std::min<uint32_t> ((m_partition.GetN () + 9) / 10, 255);
+    }
+  m_partition.Partition (k, m_uniformRandomVariable);
+
+  ClusterAssignmentHeader assignment;
+  for (uint32_t c = 0; c < m_partition.GetNClusters (); c++)
+    {
+      assignment.AddHead (m_partition.GetHead (c));
+    }
+  for (uint32_t i = 0; i < m_partition.GetN (); i++)
+    {
+      if (!m_partition.IsHead (i))
+        {
+          assignment.AddMember (m_partition.GetAddress (i), m_partition.GetCluster (i));
+        }
+    }
+  NS_LOG_DEBUG (m_partition.GetN () << " nodes in " << assignment.GetNHeads () << " clusters");
+  m_partition.Clear ();
+
+  Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (assignment);
+  packet->AddHeader (LeachControlHeader (LeachControlHeader::ASSIGNMENT));
+  socket->SetAllowBroadcast (true);
+  socket->SendTo (packet, 0, InetSocketAddress (Ipv4Address ("10.1.1.255"), LEACH_PORT));
+}
+
+void
+RoutingProtocol::RecvAssignment (Ptr<Packet> packet, Ptr<Socket> socket, Ipv4Address receiver)
+{
+  ClusterAssignmentHeader assignment;
+  packet->RemoveHeader (assignment);
+  uint32_t cluster;
+  if (!assignment.Find (m_mainAddress, cluster))
+    {
+      NS_LOG_DEBUG (m_mainAddress << " missing from the assignment, its report was lost");
+      return;
+    }
+  Ipv4Address head = assignment.GetHead (cluster);
+  Ipv4InterfaceAddress iface = m_ipv4->GetAddress (m_ipv4->GetInterfaceForAddress (receiver), 0);
+  Ptr<NetDevice> dev = socket->GetBoundNetDevice ();
+  InvalidateSinkRoute ();
+  m_clusterMember.clear ();
+  if (head == m_mainAddress)
+    {
+      NS_LOG_DEBUG (m_mainAddress << " becomes cluster head");
+      cluster_head_this_round = 1;
+      m_targetAddress = m_sinkAddress;
+      m_routingTable.RefreshRoute (dev, m_sinkAddress, iface, m_sinkAddress);
+      for (uint32_t i = 0; i < assignment.GetNMembers (); i++)
+        {
+          if (assignment.GetCluster (i) == cluster)
+            {
+              m_clusterMember.push_back (assignment.GetMember (i));
+            }
+        }
+      if (m_slotDuration.IsStrictlyPositive ())
+        {
+          m_scheduleTimer.Schedule (MicroSeconds (m_uniformRandomVariable->GetInteger (0,1000)));
+        }
+      if (m_routeHolddown.IsStrictlyPositive ())
+        {
+          // Advertise only to keep the routes of the members up
+          m_broadcastClusterHeadTimer.Schedule (MicroSeconds (m_routeHolddown.GetMicroSeconds () / 3));
+        }
+      return;
+    }
+  cluster_head_this_round = 0;
+  m_targetAddress = head;
+  m_routingTable.RefreshRoute (dev, m_sinkAddress, iface, head);
+  m_routingTable.RefreshRoute (dev, head, iface, head);
+}
+
+void
+RoutingProtocol::SendSchedule ()
+{
+  if (m_clusterMember.empty ())
+    {
+      return;
+    }
+  // One slot for the schedule to reach the members, then a slot each
+  ClusterScheduleHeader schedule (m_slotDuration, m_slotDuration);
+  for (std::vector<Ipv4Address>::const_iterator i = m_clusterMember.begin ();
+       i != m_clusterMember.end (); ++i)
+    {
+      schedule.AddSlot (*i);
+    }
+  NS_LOG_DEBUG (m_mainAddress << " schedules " << schedule.GetNSlots () << " slots");
+
+  Ptr<Socket> socket = FindSocketWithAddress (m_mainAddress);
+  Ptr<Packet> packet = Create<Packet> ();
+  packet->AddHeader (schedule);
+  packet->AddHeader (LeachControlHeader (LeachControlHeader::SCHEDULE));
+  socket->SetAllowBroadcast (true);
+  socket->SendTo (packet, 0, InetSocketAddress (Ipv4Address ("10.1.1.255"), LEACH_PORT));
+}
+
+void
+RoutingProtocol::RecvSchedule (Ptr<Packet> packet, Ipv4Address sender)
+{
+  if (cluster_head_this_round || sender != m_targetAddress)
+    {
+      return;
+    }
+  ClusterScheduleHeader schedule;
+  packet->RemoveHeader (schedule);
+  uint32_t slot;
+  if (!schedule.Find (m_mainAddress, slot))
+    {
+      NS_LOG_DEBUG (m_mainAddress << " has no slot, its join was lost");
+      return;
+    }
+  m_frameDuration = schedule.GetSlot () * schedule.GetNSlots ();
+  m_frameSlot = schedule.GetSlot ();
+  m_holding = true;
+  m_slotTimer.Cancel ();
+  m_slotTimer.Schedule (schedule.GetStart () + schedule.GetSlot () * slot);
+}
+
+void
+RoutingProtocol::SlotBoundary ()
+{
+  if (!m_holding)
+    {
+      m_holding = true;
+      m_slotTimer.Schedule (m_frameDuration - m_frameSlot);
+      return;
+    }
+  m_holding = false;
+  // Alone in the frame, the slot never ends
+  if (m_frameDuration > m_frameSlot)
+    {
+      m_slotTimer.Schedule (m_frameSlot);
+    }
+  m_dropped += m_queue.PurgeExpired (Simulator::Now ());
+  Flush ();
+}
+
+bool
+RoutingProtocol::HoldForSlot () const
+{
+  return m_holding && !m_draining;
+}
+
 void
 RoutingProtocol::SetIpv4 (Ptr<Ipv4> ipv4)
 {
@@ -696,7 +1282,7 @@ RoutingProtocol::NotifyInterfaceUp (uint32_t i)
   socket->BindToNetDevice (l3->GetNetDevice (i));
   socket->SetAllowBroadcast (true);
   socket->SetAttribute ("IpTtl",UintegerValue (1));
-  m_socketAddresses.insert (std::make_pair (socket,iface));
+  AddSocket (socket, iface, i);
   // Add local broadcast record to the routing table
   Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()));
   RoutingTableEntry rt (/*device=*/ dev, /*dst=*/ iface.GetBroadcast (),/*iface=*/ iface, /*next hop=*/ iface.GetBroadcast ());
@@ -716,7 +1302,8 @@ RoutingProtocol::NotifyInterfaceDown (uint32_t i)
   Ptr<Socket> socket = FindSocketWithInterfaceAddress (m_ipv4->GetAddress (i,0));
   NS_ASSERT (socket);
   socket->Close ();
-  m_socketAddresses.erase (socket);
+  RemoveSocket (socket);
+  InvalidateSinkRoute ();
   if (m_socketAddresses.empty ())
     {
       NS_LOG_LOGIC ("No leach interfaces");
@@ -751,7 +1338,7 @@ RoutingProtocol::NotifyAddAddress (uint32_t i,
       socket->Bind (InetSocketAddress (Ipv4Address::GetAny (), LEACH_PORT));
       socket->BindToNetDevice (l3->GetNetDevice (i));
       socket->SetAllowBroadcast (true);
-      m_socketAddresses.insert (std::make_pair (socket,iface));
+      AddSocket (socket, iface, i);
       Ptr<NetDevice> dev = m_ipv4->GetNetDevice (m_ipv4->GetInterfaceForAddress (iface.GetLocal ()));
       RoutingTableEntry rt (/*device=*/ dev, /*dst=*/ iface.GetBroadcast (), /*iface=*/ iface, /*next hop=*/ iface.GetBroadcast ());
       m_routingTable.AddRoute (rt);
@@ -765,7 +1352,7 @@ RoutingProtocol::NotifyRemoveAddress (uint32_t i,
   Ptr<Socket> socket = FindSocketWithInterfaceAddress (address);
   if (socket)
     {
-      m_socketAddresses.erase (socket);
+      RemoveSocket (socket);
       Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
       if (l3->GetNAddresses (i))
         {
@@ -777,7 +1364,7 @@ RoutingProtocol::NotifyRemoveAddress (uint32_t i,
           // Bind to any IP address so that broadcasts can be received
           socket->Bind (InetSocketAddress (Ipv4Address::GetAny (), LEACH_PORT));
           socket->SetAllowBroadcast (true);
-          m_socketAddresses.insert (std::make_pair (socket,iface));
+          AddSocket (socket, iface, i);
         }
     }
 }
@@ -785,33 +1372,56 @@ RoutingProtocol::NotifyRemoveAddress (uint32_t i,
 Ptr<Socket>
 RoutingProtocol::FindSocketWithAddress (Ipv4Address addr) const
 {
-  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddresses.begin (); j
-       != m_socketAddresses.end (); ++j)
+  std::map<Ipv4Address, Ptr<Socket> >::const_iterator j = m_addressSockets.find (addr);
+  if (j == m_addressSockets.end ())
     {
-      Ptr<Socket> socket = j->first;
-      Ipv4Address iface = j->second.GetLocal();
-      if (iface == addr)
-        {
-          return socket;
-        }
+      return NULL;
     }
-  return NULL;
+  return j->second;
 }
 
 Ptr<Socket>
 RoutingProtocol::FindSocketWithInterfaceAddress (Ipv4InterfaceAddress addr) const
 {
-  for (std::map<Ptr<Socket>, Ipv4InterfaceAddress>::const_iterator j = m_socketAddresses.begin (); j
-       != m_socketAddresses.end (); ++j)
+  Ptr<Socket> socket = FindSocketWithAddress (addr.GetLocal ());
+  if (socket == 0 || !(m_socketAddresses.find (socket)->second == addr))
+    {
+      return NULL;
+    }
+  return socket;
+}
+
+void
+RoutingProtocol::AddSocket (Ptr<Socket> socket, Ipv4InterfaceAddress iface, uint32_t i)
+{
+  m_socketAddresses.insert (std::make_pair (socket,iface));
+  m_addressSockets[iface.GetLocal ()] = socket;
+  if (i >= m_interfaceAddresses.size ())
+    {
+      m_interfaceAddresses.resize (i + 1);
+    }
+  m_interfaceAddresses[i] = iface;
+}
+
+void
+RoutingProtocol::RemoveSocket (Ptr<Socket> socket)
+{
+  std::map<Ptr<Socket>, Ipv4InterfaceAddress>::iterator j = m_socketAddresses.find (socket);
+  if (j == m_socketAddresses.end ())
+    {
+      return;
+    }
+  Ipv4Address local = j->second.GetLocal ();
+  m_addressSockets.erase (local);
+  // The address may be gone from the interface already
+  for (std::vector<Ipv4InterfaceAddress>::iterator k = m_interfaceAddresses.begin (); k != m_interfaceAddresses.end (); ++k)
     {
-      Ptr<Socket> socket = j->first;
-      Ipv4InterfaceAddress iface = j->second;
-      if (iface == addr)
+      if (k->GetLocal () == local)
         {
-          return socket;
+          *k = Ipv4InterfaceAddress ();
         }
     }
-  return NULL;
+  m_socketAddresses.erase (j);
 }
 
 void
@@ -841,263 +1451,273 @@ RoutingProtocol::EnqueuePacket (Ptr<Packet> p,
   NS_LOG_FUNCTION (this << ", " << p << ", " << header);
   NS_ASSERT (p != 0 && p != Ptr<Packet> ());
   
-  Ptr<Packet> out;
+  p = m_reassembly.Add (header, p, Simulator::Now ());
+  if (p == 0)
+    {
+      return;
+    }
   UdpHeader uhdr;
-  LeachHeader leachHeader;
-  uint32_t slot = p->GetUid()%1021;
-  struct hash* now = m_hash[slot];
-  
-  NS_LOG_DEBUG("IsDontFragement: " << header.IsDontFragment());
-  
-  if(header.GetFragmentOffset() == 0) p->RemoveHeader(uhdr);
-
-  while (now != NULL)
+  p->RemoveHeader (uhdr);
+  EnqueueFrame (p, header, true);
+  if (m_draining)
     {
-      if(now->uid == p->GetUid())
-        break;
-      now = now->next;
+      Flush ();
     }
-  if(now != NULL)
+}
+
+void
+RoutingProtocol::EnqueueFrame (Ptr<Packet> frame,
+                               const Ipv4Header & header,
+                               bool admit)
+{
+  AggregateDecoder decoder (frame);
+  if (!decoder.IsValid ())
     {
-      NS_LOG_DEBUG("now->p size " << now->p->GetSize() << ", p size " << p->GetSize());
-      now->p->AddAtEnd(p);
-      p = now->p;
-      NS_LOG_DEBUG("after p size " << p->GetSize());
+      NS_LOG_DEBUG ("Drop malformed frame " << frame->GetUid ());
+      return;
     }
-  
-  while(DeAggregate(p, out, leachHeader))
+  AggregationContext ctx = GetAggregationContext ();
+  for (uint32_t i = 0; i < decoder.GetCount (); i++)
     {
-      QueueEntry newEntry (out,header);
+      QueueEntry newEntry (decoder.GetRecord (i),header);
+      if (admit)
+        {
+          if (!m_policy->Admit (newEntry, ctx))
+            {
+              m_suppressed++;
+              continue;
+            }
+          m_forwarded++;
+        }
       bool result = m_queue.Enqueue (newEntry);
-      struct msmt temp;
-      
-      temp.begin = Simulator::Now();
-      temp.end = leachHeader.GetDeadline();
-      timeline.push_back(temp);
+      m_timelineTrace (Simulator::Now (), decoder.GetDeadline (i));
       if (result)
         {
-          NS_LOG_DEBUG ("Added packet " << out->GetUid () << " to queue.");
+          NS_LOG_DEBUG ("Added packet " << newEntry.GetPacket ()->GetUid () << " to queue.");
         }
     }
+  ScheduleFlush ();
 }
 
-bool
-RoutingProtocol::DeAggregate (Ptr<Packet> in, Ptr<Packet>& out, LeachHeader& lhdr)
+void
+RoutingProtocol::ScheduleFlush ()
 {
-  if(in->GetSize() >= 56)
+  if (m_queue.GetSize () == 0)
     {
-      LeachHeader leachHeader;
-      in->RemoveHeader(leachHeader);
-      in->RemoveAtStart(16);
-      
-      lhdr = leachHeader;
-      out = new Packet(16);
-      out->AddHeader(leachHeader);
-      NS_LOG_DEBUG("deadline" << leachHeader.GetDeadline());
-      return true;
-    }
-  uint32_t slot = in->GetUid()%1021;
-  struct hash* now = m_hash[slot];
-  while(now != NULL)
-    {
-      if(now->uid == in->GetUid()) break;
-      now = now->next;
+      m_flushTimer.Cancel ();
+      return;
     }
-  if(now == NULL) 
+  Time due = m_queue.GetDeadline (0) - m_flushGuard;
+  if (m_flushTimer.IsRunning () && due == m_flushDue)
     {
-      now = new struct hash;
-      now->uid = in->GetUid();
-      now->next = m_hash[slot];
-      m_hash[slot] = now;
+      return;
     }
-  now->p = in;
-  NS_LOG_DEBUG("Size left " << in->GetSize() << ", on UID " << in->GetUid());
-  
-  return false;
+  m_flushTimer.Cancel ();
+  m_flushDue = due;
+  Time delay = due - Simulator::Now ();
+  m_flushTimer.Schedule (delay.IsStrictlyPositive () ? delay : Seconds (0));
 }
 
-bool
-RoutingProtocol::DataAggregation (Ptr<Packet> p)
-{
-  // Implement data aggregation policy
-  // and data addgregation function
-
-#ifdef DA_PROP
-  return Proposal(p);
-#endif
-#ifdef DA_OPT
-  return OptTM(p);
-#endif
-#ifdef DA_CL
-  return ControlLimit(p);
-#endif
-#ifdef DA_SF
-  return SelectiveForwarding(p);
-#endif
-  
-  return true;
-}
-  
-bool
-RoutingProtocol::Proposal (Ptr<Packet> p)
+void
+RoutingProtocol::FlushDue ()
 {
   NS_LOG_FUNCTION (this);
-  // pick up those selected entry and send
-  int expired = 0, expected;
-  //LeachHeader hdr;
-  Time deadLine = Now();
-  
-  // 1.28 = 2*0.64, 0.064 = 64bytes/8kbps
-  // average 10 cluster heads
-  // average 10 members per cluster
-  deadLine += Seconds(m_queue.GetSize()/m_lambda);
-  if(!cluster_head_this_round)
-    // depend on average tx size from cluster member
-    // depend on deadline setting
-    // * average packet_size?
-    deadLine += Seconds(0.064+1.0/m_lambda);
-
-//  NS_LOG_UNCOND("Now: " << Now() << ", Deadline: " << deadLine);
-  for (int i=0; i<(int)m_queue.GetSize(); i++)
-    {
-      NS_LOG_DEBUG("GetDeadline: " << m_queue[i].GetDeadline() << ", UID: " << m_queue[i].GetPacket()->GetUid() << ", Now: " << Now());
-      if(m_queue[i].GetDeadline() < Now())
-        {
-          // drop it
-          NS_LOG_DEBUG("Drop");
-//          NS_LOG_DEBUG("GetLeachHeader: " << m_queue[i].GetDeadline() << ", Now: " << Now());
-          m_queue.Drop (i);
-          m_dropped++;
-          i--;
-        }
+  m_dropped += m_queue.PurgeExpired (Simulator::Now ());
+  if (m_queue.GetSize () == 0)
+    {
+      return;
     }
-  
-  for(uint32_t i=0; i<m_queue.GetSize(); i++) {
-//    NS_LOG_UNCOND("GetDeadline: " << m_queue[i].GetDeadline() << ", deadline: " << deadLine);
-    if(m_queue[i].GetDeadline() < deadLine) {
-      expired++;
+  if (m_queue.GetDeadline (0) - m_flushGuard > Simulator::Now ())
+    {
+      // The reading that armed the timer left with an earlier frame
+      ScheduleFlush ();
+      return;
     }
-  }
-  if(cluster_head_this_round) {
-    expected = 1+m_clusterMember.size();
-  }
-  else {
-    expected = 1;
-  }
-  
-//  NS_LOG_UNCOND("expired: " << expired << ", expected: " << expected);
-  if(expired >= expected || Now() > Seconds(48.5)) {
-    // merge data
-    QueueEntry temp;
-    
-    while(m_queue.Dequeue(m_sinkAddress, temp)) {
-      p->AddAtEnd(temp.GetPacket());
-    }
-    
-    return true;
-  }
-  return false;
+  if (HoldForSlot ())
+    {
+      // The slot of this member sends the buffer
+      return;
+    }
+  if (GetSinkRoute () == 0)
+    {
+      // Frames without a route come back to the buffer; the next reading
+      // arms the timer again
+      NS_LOG_DEBUG ("No route to the sink, keep the buffer");
+      return;
+    }
+  Flush ();
 }
 
 bool
-RoutingProtocol::OptTM (Ptr<Packet> p)
+RoutingProtocol::DataAggregation (Ptr<Packet> p, Time deadline)
 {
-  Time time = Now();
-  uint32_t rewards[100], maxR = 0;
-  uint32_t actions[100];
-  static int step = 0;
-  
-  for(int i=0; i<100; i++)
+  m_encoder.Start (p, deadline, m_aggregateFormat);
+  bool flush = true;
+  if (m_policy->IsAggregating ())
     {
-      actions[i] = 0;
-      rewards[i] = 0;
-      for(uint j=0; j<m_queue.GetSize(); j++)
-        {
-          if(m_queue[j].GetDeadline() >= time) rewards[i] += m_queue[j].GetDeadline().ToInteger(Time::MS) - time.ToInteger(Time::MS);
-        }
-      for(int j=1; j<i+step; j++)
+      // Let the policy decide whether the buffered readings go along
+      AggregationContext ctx = GetAggregationContext ();
+      uint32_t dropped = 0;
+
+      // Expired readings are still dropped while draining
+      flush = m_policy->Decide (m_queue, ctx, dropped) || m_draining;
+      if (dropped)
         {
-          rewards[i] += (j<8) ?30000-j*4000 :0;
+          m_dropped += dropped;
         }
-      time += Seconds(1/m_lambda);
     }
-  
-  for(int i=0; i<100; i++)
+  if (HoldForSlot ())
     {
-      if(rewards[i] > maxR)
-        {
-          maxR = rewards[i];
-        }
+      flush = false;
     }
-  
-  // wait=1, transmit=2
-  for(int i=98; i>=0; i--)
+  if (flush && GetSinkRoute () == 0)
     {
-      if(rewards[i] < maxR)
-        actions[i] = 1;
-      else
+      // Without a route only the new reading loops back to the buffer; the
+      // buffered ones were admitted already and stay where they are
+      NS_LOG_DEBUG ("No route to the sink, keep the buffer");
+      flush = false;
+    }
+  if (flush)
+    {
+      // Fill this frame first, the rest goes in further frames
+      uint32_t limit = GetAggregateLimit ();
+      m_queue.DequeueAll (m_sinkAddress, m_dequeued);
+      std::list<QueueEntry>::const_iterator i = m_dequeued.begin ();
+      for (; i != m_dequeued.end () && m_encoder.GetSizeAfter (i->GetPacket (), i->GetDeadline ()) <= limit; ++i)
         {
-          double rb[100], rn[100];
-          rb[99] = 1.0;
-          rn[99] = 0.0;
+          m_encoder.Add (i->GetPacket (), i->GetDeadline ());
+        }
+      SendFrames (i, m_dequeued.end ());
+      m_queue.Recycle (m_dequeued);
+    }
+  m_encoder.Finish ();
+  return flush;
+}
 
-          for(int k=98; k>i; k--)
-            {
-              rn[k] = max(0.0, i*rn[k+1]/(k+1) + rb[k+1]/(k+1));
-              rb[k] = max(rewards[k], rn[k]);
-            }
+AggregationContext
+RoutingProtocol::GetAggregationContext () const
+{
+  AggregationContext ctx;
+  ctx.lambda = m_arrivals.GetRate ();
+  ctx.clusterHead = cluster_head_this_round;
+  ctx.members = m_clusterMember.size ();
+  return ctx;
+}
 
-          if(rewards[i] >= (uint32_t)rb[i+1])
-            actions[i] = 2;
-          else
-            actions[i] = 1;
-        }
+void
+RoutingProtocol::StampReading (Ptr<Packet> p) const
+{
+  LeachHeader hdr;
+  p->PeekHeader (hdr);
+  if (hdr.GetAddress () != Ipv4Address::GetBroadcast ())
+    {
+      return;
     }
-  step++;
-  
-  if(actions[0] > 1 || Now() > Seconds(48.5))
+  p->RemoveHeader (hdr);
+  hdr.SetPosition (m_position);
+  hdr.SetAddress (m_mainAddress);
+  p->AddHeader (hdr);
+}
+
+void
+RoutingProtocol::SendFrames (std::list<QueueEntry>::const_iterator begin,
+                             std::list<QueueEntry>::const_iterator end)
+{
+  uint32_t limit = GetAggregateLimit ();
+  // One event sends all the frames packed before it runs
+  bool idle = m_pendingFrames.empty ();
+  AggregateEncoder encoder (m_aggregateFormat);
+  for (std::list<QueueEntry>::const_iterator i = begin; i != end; ++i)
     {
-      QueueEntry temp;
-      while(m_queue.Dequeue(m_sinkAddress, temp))
+      if (encoder.GetCount () > 0 && encoder.GetSizeAfter (i->GetPacket (), i->GetDeadline ()) > limit)
         {
-          p->AddAtEnd(temp.GetPacket());
+          m_pendingFrames.push_back (encoder.Finish ());
         }
-      
-      return true;
+      encoder.Add (i->GetPacket (), i->GetDeadline ());
+    }
+  if (encoder.GetCount () > 0)
+    {
+      m_pendingFrames.push_back (encoder.Finish ());
+    }
+  if (idle && !m_pendingFrames.empty ())
+    {
+      Simulator::ScheduleNow (&RoutingProtocol::SendPendingFrames, this);
     }
-  
-  return false;
 }
-  
+
+void
+RoutingProtocol::SendPendingFrames ()
+{
+  m_sendingFrames.swap (m_pendingFrames);
+  for (std::vector<Ptr<Packet> >::const_iterator i = m_sendingFrames.begin ();
+       i != m_sendingFrames.end (); ++i)
+    {
+      SendFrame (*i);
+    }
+  m_sendingFrames.clear ();
+}
+
+void
+RoutingProtocol::Drain ()
+{
+  NS_LOG_FUNCTION (this);
+  m_draining = true;
+  Flush ();
+}
+
 bool
-RoutingProtocol::ControlLimit (Ptr<Packet> p)
+RoutingProtocol::IsDraining () const
+{
+  return m_draining;
+}
+
+void
+RoutingProtocol::Flush ()
 {
-  static uint32_t threshold = (1/(log(1/0.1)*(log(1/0.1)+m_lambda)))+2;
-  for(int i=0; i<(int)m_queue.GetSize(); i++)
+  if (m_queue.DequeueAll (m_sinkAddress, m_dequeued) > 0)
     {
-      if(m_queue[i].GetDeadline() < Now())
-        {
-          m_queue.Drop(i);
-          m_dropped++;
-          i--;
-        }
+      NS_LOG_DEBUG ("Flush " << m_dequeued.size () << " buffered readings");
+      SendFrames (m_dequeued.begin (), m_dequeued.end ());
+      m_queue.Recycle (m_dequeued);
     }
-    
-  if(m_queue.GetSize() >= threshold || Now() > Seconds(48.5))
+}
+
+uint32_t
+RoutingProtocol::GetAggregateLimit () const
+{
+  uint32_t limit = m_maxAggregateSize;
+  int32_t interface = m_ipv4->GetInterfaceForAddress (m_mainAddress);
+  if (interface >= 0)
     {
-      QueueEntry temp;
-      while(m_queue.Dequeue(m_sinkAddress, temp)) {
-        p->AddAtEnd(temp.GetPacket());
-      }
-      return true;
+      // IPv4 and UDP headers
+      limit = std::min<uint32_t> (limit, m_ipv4->GetMtu (interface) - 28);
     }
-  return false;
+  return limit;
 }
-  
-bool
-RoutingProtocol::SelectiveForwarding (Ptr<Packet> p)
+
+void
+RoutingProtocol::SendFrame (Ptr<Packet> frame)
 {
-  return false;
+  NS_LOG_FUNCTION (this << frame->GetSize ());
+  Ptr<Ipv4Route> route = GetSinkRoute ();
+  if (route == 0)
+    {
+      NS_LOG_DEBUG ("No route to the sink, buffer the frame again");
+      Ipv4Header header;
+      header.SetDestination (m_sinkAddress);
+      EnqueueFrame (frame, header, false);
+      return;
+    }
+  m_txTimeTrace (Simulator::Now ());
+  m_timelineTrace (Simulator::Now (), AggregateDecoder (frame).GetDeadline (0));
+
+  UdpHeader udp;
+  udp.SetSourcePort (LEACH_PORT);
+  udp.SetDestinationPort (m_sinkPort);
+  frame->AddHeader (udp);
+  Ptr<Ipv4L3Protocol> l3 = m_ipv4->GetObject<Ipv4L3Protocol> ();
+  NS_ASSERT (l3 != 0);
+  l3->Send (frame,route->GetSource (),m_sinkAddress,UdpL4Protocol::PROT_NUMBER,route);
 }
 
 }
@@ -36,6 +36,11 @@
 #include "leach-rtable.h"
 #include "leach-packet-queue.h"
 #include "leach-packet.h"
+#include "leach-aggregate.h"
+#include "leach-reassembly-cache.h"
+#include "leach-rate-estimator.h"
+#include "leach-aggregation-policy.h"
+#include "leach-cluster-partition.h"
 #include "ns3/node.h"
 #include "ns3/random-variable-stream.h"
 #include "ns3/ipv4-routing-protocol.h"
@@ -44,6 +49,7 @@
 #include "ns3/output-stream-wrapper.h"
 #include "ns3/vector.h"
 #include "ns3/traced-value.h"
+#include "ns3/traced-callback.h"
 
 
 #include <vector>
@@ -51,12 +57,6 @@
 namespace ns3 {
 namespace leach {
 
-
-struct msmt{
-  Time begin;
-  Time end;
-};
-  
 /**
  * \ingroup leach
  * \brief LEACH routing protocol.
@@ -68,6 +68,20 @@ public:
   GetTypeId (void);
   static const uint32_t LEACH_PORT;
 
+  /// How a node decides to become cluster head
+  enum Election
+  {
+    CLASSIC = 0, //!< LEACH threshold p/(1-p*(Round%n))
+    ENERGY = 1, //!< LEACH threshold weighted by the remaining energy
+    CENTRALIZED = 2, //!< LEACH-C: the sink partitions the nodes from their reports
+  };
+  /// How a cluster head reaches the sink
+  enum HeadRouting
+  {
+    DIRECT = 0, //!< straight to the sink
+    OVERLAY = 1, //!< through a cluster head closer to the sink, when cheaper
+  };
+
   /// c-tor
   RoutingProtocol ();
   virtual
@@ -89,9 +103,48 @@ public:
   // Methods to handle protocol parameters
   void SetPosition (Vector f);
   Vector GetPosition () const;
-  
-  std::vector<struct msmt>* getTimeline();
-  std::vector<Time>* getTxTime();
+
+  /**
+   * TracedCallback signature of the Timeline trace source
+   * \param begin time a reading was sent or buffered
+   * \param end its deadline
+   */
+  typedef void (* TimelineTracedCallback)(Time begin, Time end);
+  /**
+   * TracedCallback signature of the TxTime trace source
+   * \param now time a frame left for the sink
+   */
+  typedef void (* TxTimeTracedCallback)(Time now);
+
+  void SetRateEstimatorWeight (double weight);
+  double GetRateEstimatorWeight () const;
+  /// Packet generation rate of this node, estimated from its readings
+  double GetArrivalRate () const;
+  /**
+   * Factor the Energy election applies to the classic threshold: the
+   * remaining energy fraction, rising to 1 as the node stays member for a
+   * whole cycle of rounds, and never above
+   */
+  static double GetEnergyWeight (double fraction, uint32_t roundsAsMember, uint32_t cycle);
+  void SetDeferredQueueLength (uint32_t len);
+  uint32_t GetDeferredQueueLength () const;
+  void SetReassemblyEntries (uint32_t n);
+  uint32_t GetReassemblyEntries () const;
+  void SetReassemblyMaxBytes (uint32_t bytes);
+  uint32_t GetReassemblyMaxBytes () const;
+  void SetReassemblyTimeout (Time t);
+  Time GetReassemblyTimeout () const;
+  /// Reassembly state and counters of forwarded aggregates
+  const ReassemblyCache & GetReassemblyCache () const;
+
+  /**
+   * Stop buffering: send the buffered readings now, and from then on every
+   * reading as soon as it is generated or received.  Scheduled DrainLead
+   * before StopTime when that is set.
+   */
+  void Drain ();
+  /// Whether Drain () was called
+  bool IsDraining () const;
 
  /**
   * Assign a fixed random variable stream number to the random variables
@@ -114,20 +167,64 @@ private:
   uint32_t cluster_head_this_round;
   uint32_t isSink;
   TracedValue<uint32_t> m_dropped;
+  /// Readings the policy suppressed as redundant
+  TracedValue<uint32_t> m_suppressed;
+  /// Readings the policy let into the buffer
+  TracedValue<uint32_t> m_forwarded;
   double   m_lambda;
-  
-  struct hash{
-    uint32_t uid;
-    Ptr<Packet> p;
-    struct hash* next;
-  }*m_hash[1021];
-  
-  std::vector<struct msmt> timeline;
-  std::vector<Time> tx_time;
+  /// Rate of the readings of this node, starting from m_lambda
+  RateEstimator m_arrivals;
+  /// Maximum size of an aggregate frame, UDP header excluded
+  uint32_t m_maxAggregateSize;
+  /// UDP port of the sink application
+  uint16_t m_sinkPort;
+  /// Encoding of the frames this node sends
+  AggregateHeader::Format m_aggregateFormat;
+  /// Time the simulation stops, zero if unknown
+  Time m_stopTime;
+  /// Time before m_stopTime the node drains
+  Time m_drainLead;
+  /// Time before the earliest buffered deadline the buffer is sent
+  Time m_flushGuard;
+  /// Time m_flushTimer is set to expire at
+  Time m_flushDue;
+  /// Whether buffered readings are sent without waiting
+  bool m_draining;
+  /// How this node decides to become cluster head
+  Election m_election;
+  /// Rounds since this node was last cluster head
+  uint32_t m_roundsAsMember;
+  /// Clusters the sink forms in LEACH-C, 0 for a tenth of the nodes
+  uint32_t m_clusterCount;
+  /// Time the sink collects reports for, from the first of a round
+  Time m_reportWindow;
+  /// Reports the sink collected this round
+  ClusterPartition m_partition;
+  /// How this node reaches the sink as cluster head
+  HeadRouting m_headRouting;
+  /// Position of the sink, as the last sink beacon told
+  Vector m_sinkPosition;
+  /// Next hop of this cluster head towards the sink
+  Ipv4Address m_headNextHop;
+  /// Squared distances to m_headNextHop, and from it to the sink
+  double m_headCost;
+  /// TDMA slot of each cluster member, zero to contend for the channel
+  Time m_slotDuration;
+  /// TDMA frame of the cluster of this member, and the slots in it
+  Time m_frameDuration;
+  Time m_frameSlot;
+  /// Whether a schedule is in force and the slot of this member is not on
+  bool m_holding;
+  /// Readings sent or buffered, with their deadline
+  TracedCallback<Time, Time> m_timelineTrace;
+  /// Frames sent to the sink
+  TracedCallback<Time> m_txTimeTrace;
 
   /// PeriodicUpdateInterval specifies the periodic time interval between which the a node broadcasts
   /// its entire routing table.
   Time m_periodicUpdateInterval;
+  /// How long a route of the round lasts without word from its next hop
+  Time m_routeHolddown;
   /// Nodes IP address
   Ipv4Address m_mainAddress;
   /// Cluster Head/Sink Address
@@ -142,16 +239,39 @@ private:
   Ptr<Ipv4> m_ipv4;
   /// Raw socket per each IP interface, map socket -> iface address (IP + mask)
   std::map<Ptr<Socket>, Ipv4InterfaceAddress> m_socketAddresses;
+  /// Sockets of m_socketAddresses by local address
+  std::map<Ipv4Address, Ptr<Socket> > m_addressSockets;
+  /// Address of the socket on each interface, by interface index; unset where there is none
+  std::vector<Ipv4InterfaceAddress> m_interfaceAddresses;
   /// Loopback device used to defer route requests until a route is found
   Ptr<NetDevice> m_lo;
   /// Main Routing table for the node
   RoutingTable m_routingTable;
+  /// Route to the sink for this round, resolved on first use
+  Ptr<Ipv4Route> m_sinkRoute;
+  /// Loopback route readings to the sink take while buffered, and its oif
+  Ptr<Ipv4Route> m_sinkLoopback;
+  Ptr<NetDevice> m_sinkLoopbackOif;
+  /// Readings taken from m_queue to be sent, handed back to it once framed
+  std::list<QueueEntry> m_dequeued;
+  /// Frames SendFrames packed, sent by a single event
+  std::vector<Ptr<Packet> > m_pendingFrames;
+  /// Frames SendPendingFrames is sending; keeps its capacity across calls
+  std::vector<Ptr<Packet> > m_sendingFrames;
+  /// Reused for the frame of each reading, to keep its tables allocated
+  AggregateEncoder m_encoder;
   /// From selecting CHs, the best stores here
   RoutingTableEntry m_bestRoute;
   /// Node position
   Vector m_position;
   /// A "drop front on full" queue used by the routing layer to buffer packets to which it does not have a route.
   PacketQueue m_queue;
+  /// Fragments of forwarded aggregates
+  ReassemblyCache m_reassembly;
+  /// Type of the data aggregation policy
+  TypeId m_policyTypeId;
+  /// Data aggregation policy deciding when m_queue is sent
+  Ptr<AggregationPolicy> m_policy;
   /// Unicast callback for own packets
   UnicastForwardCallback m_scb;
   /// Error callback for own packets
@@ -162,24 +282,63 @@ private:
   /// Start protocol operation
   void
   Start ();
-  /// Queue packet until we find a route
+  /// Buffer the records of an aggregate frame, once all its fragments arrived
   void
   EnqueuePacket (Ptr<Packet> p, const Ipv4Header & header);
-  /// Decide whether to send the packets in the buffer
-  bool
-  DataAggregation (Ptr<Packet> p);
-  bool
-  Proposal (Ptr<Packet> p);
-  bool
-  OptTM (Ptr<Packet> p);
-  bool
-  ControlLimit (Ptr<Packet> p);
-  bool
-  SelectiveForwarding (Ptr<Packet> p);
-  
-  /// De-aggregate chunk of data
+  /**
+   * Buffer the records of a whole aggregate frame
+   * \param admit whether the policy filters the records first; false for
+   *        records that were already admitted once
+   */
+  void
+  EnqueueFrame (Ptr<Packet> frame, const Ipv4Header & header, bool admit);
+  /// State the policy bases its decisions on
+  AggregationContext
+  GetAggregationContext () const;
+  /// Fill in position and address of an own reading that left them unset
+  void
+  StampReading (Ptr<Packet> p) const;
+  /**
+   * Turn reading p into an aggregate frame, with the buffered readings
+   * when the policy decides to send them.  Readings that do not fit in
+   * MaxAggregateSize go in further frames, sent by SendFrame.
+   * \return true if the frame is to be sent now
+   */
   bool
-  DeAggregate (Ptr<Packet> in, Ptr<Packet>& out, LeachHeader&);
+  DataAggregation (Ptr<Packet> p, Time deadline);
+  /// Route to the sink, null while there is none
+  Ptr<Ipv4Route>
+  GetSinkRoute ();
+  /// Forget the cached sink routes, when the route to the sink changes
+  void
+  InvalidateSinkRoute ();
+  /// Told by the routing table that the route to dst went stale mid-round
+  void
+  RouteExpired (Ipv4Address dst);
+  /// Largest frame that is sent unfragmented, UDP header excluded
+  uint32_t
+  GetAggregateLimit () const;
+  /// Send an aggregate frame of our own to the sink
+  void
+  SendFrame (Ptr<Packet> frame);
+  /// Pack readings into frames of at most GetAggregateLimit () bytes and send them
+  void
+  SendFrames (std::list<QueueEntry>::const_iterator begin, std::list<QueueEntry>::const_iterator end);
+  /// Send the frames SendFrames packed
+  void
+  SendPendingFrames ();
+  /// Loopback route of buffered readings to the sink, cached per oif
+  Ptr<Ipv4Route>
+  GetSinkLoopback (const Ipv4Header &header, Ptr<NetDevice> oif);
+  /// Send all buffered readings now
+  void
+  Flush ();
+  /// Arm m_flushTimer for the earliest buffered deadline, less FlushGuard
+  void
+  ScheduleFlush ();
+  /// Send the buffer, unless its earliest deadline left with another frame
+  void
+  FlushDue ();
   
   /// Find socket with local interface address iface
   Ptr<Socket>
@@ -187,11 +346,23 @@ private:
   /// Find socket with local address iface
   Ptr<Socket>
   FindSocketWithAddress (Ipv4Address iface) const;
+  /// Add socket, bound to iface on interface i, to m_socketAddresses and its indexes
+  void
+  AddSocket (Ptr<Socket> socket, Ipv4InterfaceAddress iface, uint32_t i);
+  /// Remove socket from m_socketAddresses and its indexes
+  void
+  RemoveSocket (Ptr<Socket> socket);
   
   // Receive leach control packets
   /// Receive and process leach control packet
   void
   RecvLeach (Ptr<Socket> socket);
+  /// Consider joining, or routing through, the cluster head sender at senderPosition
+  void
+  RecvAdvertisement (Vector senderPosition, Ipv4Address sender, Ptr<Socket> socket, Ipv4Address receiver);
+  /// At the sink, tell the nodes its position
+  void
+  SendSinkBeacon ();
 
   void
   Send (Ptr<Ipv4Route>, Ptr<const Packet>, const Ipv4Header &);
@@ -204,23 +375,54 @@ private:
   /// Select the cluster head selection result
   void
   PeriodicUpdate ();
+  /// Overlay: take the cluster head at position as next hop if that is cheaper
+  void
+  ConsiderHeadRoute (Ipv4Address head, Vector position, Ptr<Socket> socket, Ipv4Address receiver);
+  /// Route this cluster head to the sink through m_headNextHop
+  void
+  InstallHeadRoute (Ptr<NetDevice> dev, Ipv4InterfaceAddress iface);
+  /// Remaining over initial energy of the sources of this node, 1 without any
+  double
+  GetEnergyFraction () const;
+  /// LEACH-C: report position and energy to the sink
+  void
+  SendReport ();
+  /// LEACH-C: collect the report of sender, at the sink
+  void
+  RecvReport (Ptr<Packet> packet, Ipv4Address sender);
+  /// LEACH-C: partition the reporting nodes and broadcast the clusters
+  void
+  SendAssignment ();
+  /// LEACH-C: join the cluster the sink assigned, received on socket
+  void
+  RecvAssignment (Ptr<Packet> packet, Ptr<Socket> socket, Ipv4Address receiver);
+  /// TDMA: give each member of this cluster head a slot, and broadcast the frame
+  void
+  SendSchedule ();
+  /// TDMA: follow the schedule of the cluster head sender
+  void
+  RecvSchedule (Ptr<Packet> packet, Ipv4Address sender);
+  /// TDMA: start or end the slot of this member
+  void
+  SlotBoundary ();
+  /// Whether readings wait for the slot of this member
+  bool
+  HoldForSlot () const;
   /// Cluster member tell their cluster head
   void
   RespondToClusterHead ();
-#ifndef DA
-  /// Deal with No DA
+  /// Without aggregation, keep a packet until a route is found
   void
-  EnqueueForNoDA(UnicastForwardCallback ucb, Ptr<Ipv4Route> rt, Ptr<const Packet> p, const Ipv4Header &header);
+  EnqueueForNoDA(UnicastForwardCallback ucb, Ptr<const Packet> p, const Ipv4Header &header);
+  /// Forward the deferred packets that have a route now
   void
   AutoDequeueNoDA();
-  struct DeferredPack{
-    UnicastForwardCallback ucb;
-    Ptr<Ipv4Route> rt;
-    Ptr<const Packet> p;
-    Ipv4Header header;
-  };
-  std::vector<struct DeferredPack> DeferredQueue;
-#endif
+  /// Packets waiting for a route without aggregation
+  DeferredQueue m_deferredQueue;
+  /// Time between route lookups of deferred packets
+  Time m_deferredInterval;
+  /// Failed route lookups before a deferred packet is dropped
+  uint32_t m_deferredRetries;
   /// Notify that packet is dropped for some reason
   void
   Drop (Ptr<const Packet>, const Ipv4Header &, Socket::SocketErrno);
@@ -230,6 +432,22 @@ private:
   Timer m_broadcastClusterHeadTimer;
   /// Timer to feedback the cluster head its member
   Timer m_respondToClusterHeadTimer;
+  /// Timer releasing m_deferredQueue, running while it is not empty
+  Timer m_deferredTimer;
+  /// Timer starting to drain DrainLead before StopTime
+  Timer m_drainTimer;
+  /// Timer sending the buffer before its earliest deadline
+  Timer m_flushTimer;
+  /// LEACH-C: timer sending the report of this round
+  Timer m_reportTimer;
+  /// LEACH-C: timer closing the report window, at the sink
+  Timer m_assignTimer;
+  /// TDMA: timer sending the schedule once the members joined
+  Timer m_scheduleTimer;
+  /// Timer sending the sink beacon every PeriodicUpdateInterval
+  Timer m_beaconTimer;
+  /// TDMA: timer at the next start or end of the slot of this member
+  Timer m_slotTimer;
 
   /// Provides uniform random variables.
   Ptr<UniformRandomVariable> m_uniformRandomVariable;  
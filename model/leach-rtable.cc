@@ -31,6 +31,7 @@
 #include "leach-rtable.h"
 #include "ns3/simulator.h"
 #include <iomanip>
+#include <algorithm>
 #include "ns3/log.h"
 
 namespace ns3 {
@@ -43,7 +44,9 @@ RoutingTableEntry::RoutingTableEntry (Ptr<NetDevice> dev,
                                       Ipv4InterfaceAddress iface,
                                       Ipv4Address nextHop)
   : m_iface (iface),
-    m_flag (VALID)
+    m_flag (VALID),
+    m_epoch (0),
+    m_expiryTick (0)
 {
   m_ipv4Route = Create<Ipv4Route> ();
   m_ipv4Route->SetDestination (dst);
@@ -55,25 +58,249 @@ RoutingTableEntry::~RoutingTableEntry ()
 {
 }
 RoutingTable::RoutingTable ()
+  : m_epoch (1),
+    m_wheelNow (0),
+    m_wheelItems (0)
 {
+  Clear ();
+}
+
+RoutingTable::~RoutingTable ()
+{
+  m_wheelEvent.Cancel ();
+}
+
+void
+RoutingTable::Clear ()
+{
+  m_entries.clear ();
+  m_keys.clear ();
+  Bucket free = { 0, 0 };
+  m_buckets.assign (16, free);
+  m_shift = 28;
+  for (uint32_t level = 0; level < 2; level++)
+    {
+      for (uint32_t slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+          m_wheel[level][slot].clear ();
+        }
+    }
+  m_wheelItems = 0;
+  m_wheelEvent.Cancel ();
+}
+
+void
+RoutingTable::Setholddowntime (Time t)
+{
+  m_holddownTime = t;
+  if (m_wheelItems == 0)
+    {
+      // Pending items are in ticks of the old length
+      m_tick = NanoSeconds (std::max<int64_t> (t.GetNanoSeconds () / 16, 1));
+    }
+}
+
+uint64_t
+RoutingTable::GetTick (Time t) const
+{
+  int64_t step = m_tick.GetTimeStep ();
+  return (t.GetTimeStep () + step - 1) / step;
+}
+
+uint64_t
+RoutingTable::ScheduleExpiry (uint32_t key, Time expire)
+{
+  Time now = Simulator::Now ();
+  if (m_wheelItems == 0)
+    {
+      // Nothing is pending, the wheel may jump to now
+      m_wheelNow = now.GetTimeStep () / m_tick.GetTimeStep ();
+    }
+  // The slot of m_wheelNow is behind us already
+  WheelItem item = { key, std::max (GetTick (expire), m_wheelNow + 1) };
+  Place (item);
+  m_wheelItems++;
+  if (!m_wheelEvent.IsRunning ())
+    {
+      Time next = TimeStep (m_tick.GetTimeStep () * (m_wheelNow + 1)) - now;
+      m_wheelEvent = Simulator::Schedule (next, &RoutingTable::Tick, this);
+    }
+  return item.tick;
+}
+
+void
+RoutingTable::ArmExpiry (RoutingTableEntry &rt)
+{
+  rt.SetExpireTime (Simulator::Now () + m_holddownTime);
+  // An earlier pending item is filed again when it fires
+  if (rt.GetExpiryTick () == 0)
+    {
+      rt.SetExpiryTick (ScheduleExpiry (rt.GetDestination ().Get (), rt.GetExpireTime ()));
+    }
+}
+
+void
+RoutingTable::Place (const WheelItem &item)
+{
+  uint64_t tick = std::max (item.tick, m_wheelNow);
+  if (tick - m_wheelNow < WHEEL_SLOTS)
+    {
+      m_wheel[0][tick % WHEEL_SLOTS].push_back (item);
+      return;
+    }
+  // Farther than level 1 spans, the item is placed again on the way
+  tick = std::min<uint64_t> (tick, m_wheelNow + WHEEL_SLOTS * WHEEL_SLOTS - 1);
+  m_wheel[1][(tick / WHEEL_SLOTS) % WHEEL_SLOTS].push_back (item);
+}
+
+void
+RoutingTable::Tick ()
+{
+  uint64_t now = Simulator::Now ().GetTimeStep () / m_tick.GetTimeStep ();
+  std::vector<WheelItem> due;
+  while (m_wheelNow < now && m_wheelItems > 0)
+    {
+      m_wheelNow++;
+      if (m_wheelNow % WHEEL_SLOTS == 0)
+        {
+          // Move the level 1 slot starting now down to level 0
+          due.swap (m_wheel[1][(m_wheelNow / WHEEL_SLOTS) % WHEEL_SLOTS]);
+          for (std::vector<WheelItem>::const_iterator i = due.begin (); i != due.end (); ++i)
+            {
+              Place (*i);
+            }
+          due.clear ();
+        }
+      due.swap (m_wheel[0][m_wheelNow % WHEEL_SLOTS]);
+      for (std::vector<WheelItem>::const_iterator i = due.begin (); i != due.end (); ++i)
+        {
+          if (i->tick > m_wheelNow)
+            {
+              Place (*i);
+              continue;
+            }
+          m_wheelItems--;
+          ExpireRoute (*i);
+        }
+      due.clear ();
+    }
+  // ExpireRoute may have restarted the wheel already
+  if (m_wheelItems > 0 && !m_wheelEvent.IsRunning ())
+    {
+      m_wheelEvent = Simulator::Schedule (m_tick, &RoutingTable::Tick, this);
+    }
+}
+
+void
+RoutingTable::ExpireRoute (const WheelItem &item)
+{
+  const Bucket &bucket = m_buckets[FindBucket (item.key)];
+  if (bucket.pos == 0)
+    {
+      return;
+    }
+  RoutingTableEntry &rt = m_entries[bucket.pos - 1];
+  if (rt.GetExpiryTick () != item.tick)
+    {
+      // Item of an entry deleted since, the current one has its own
+      return;
+    }
+  rt.SetExpiryTick (0);
+  if (rt.GetEpoch () == 0 || !IsCurrent (rt))
+    {
+      return;
+    }
+  if (rt.GetExpireTime () > Simulator::Now ())
+    {
+      // Refreshed or touched since the item was filed
+      rt.SetExpiryTick (ScheduleExpiry (item.key, rt.GetExpireTime ()));
+      return;
+    }
+  NS_LOG_DEBUG ("Route to " << Ipv4Address (item.key) << " expired");
+  rt.SetFlag (INVALID);
+  if (!m_expireCallback.IsNull ())
+    {
+      m_expireCallback (Ipv4Address (item.key));
+    }
+}
+
+uint32_t
+RoutingTable::FindBucket (uint32_t key) const
+{
+  uint32_t mask = m_buckets.size () - 1;
+  uint32_t b = Home (key);
+  while (m_buckets[b].pos != 0 && m_buckets[b].key != key)
+    {
+      b = (b + 1) & mask;
+    }
+  return b;
+}
+
+void
+RoutingTable::Grow ()
+{
+  std::vector<Bucket> old;
+  old.swap (m_buckets);
+  Bucket free = { 0, 0 };
+  m_buckets.assign (old.size () * 2, free);
+  m_shift--;
+  for (std::vector<Bucket>::const_iterator i = old.begin (); i != old.end (); ++i)
+    {
+      if (i->pos != 0)
+        {
+          m_buckets[FindBucket (i->key)] = *i;
+        }
+    }
+}
+
+void
+RoutingTable::Erase (uint32_t pos)
+{
+  uint32_t mask = m_buckets.size () - 1;
+  uint32_t hole = FindBucket (m_keys[pos]);
+  // Shift back the entries whose probe sequence runs through the hole
+  for (uint32_t j = (hole + 1) & mask; m_buckets[j].pos != 0; j = (j + 1) & mask)
+    {
+      if (((j - Home (m_buckets[j].key)) & mask) >= ((j - hole) & mask))
+        {
+          m_buckets[hole] = m_buckets[j];
+          hole = j;
+        }
+    }
+  m_buckets[hole].pos = 0;
+
+  uint32_t last = m_entries.size () - 1;
+  if (pos != last)
+    {
+      m_entries[pos] = m_entries[last];
+      m_keys[pos] = m_keys[last];
+      m_buckets[FindBucket (m_keys[pos])].pos = pos + 1;
+    }
+  m_entries.pop_back ();
+  m_keys.pop_back ();
+}
+
+const RoutingTableEntry *
+RoutingTable::LookupRoute (Ipv4Address dst) const
+{
+  const Bucket &bucket = m_buckets[FindBucket (dst.Get ())];
+  if (bucket.pos == 0 || !IsCurrent (m_entries[bucket.pos - 1]))
+    {
+      return 0;
+    }
+  return &m_entries[bucket.pos - 1];
 }
 
 bool
 RoutingTable::LookupRoute (Ipv4Address id,
                            RoutingTableEntry & rt)
 {
-  if (m_ipv4AddressEntry.empty ())
-    {
-//      NS_LOG_UNCOND("1");
-      return false;
-    }
-  std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  const RoutingTableEntry *entry = LookupRoute (id);
+  if (entry == 0)
     {
-//      NS_LOG_UNCOND("2");
       return false;
     }
-  rt = i->second;
+  rt = *entry;
   return true;
 }
 
@@ -82,74 +309,137 @@ RoutingTable::LookupRoute (Ipv4Address id,
                            RoutingTableEntry & rt,
                            bool forRouteInput)
 {
-  if (m_ipv4AddressEntry.empty ())
+  const RoutingTableEntry *entry = LookupRoute (id);
+  if (entry == 0)
     {
       return false;
     }
-  std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.find (id);
-  if (i == m_ipv4AddressEntry.end ())
+  if (forRouteInput == true && id == entry->GetInterface ().GetBroadcast ())
     {
       return false;
     }
-  if (forRouteInput == true && id == i->second.GetInterface ().GetBroadcast ())
-    {
-      return false;
-    }
-  rt = i->second;
+  rt = *entry;
   return true;
 }
 
 bool
 RoutingTable::DeleteRoute (Ipv4Address dst)
 {
-  if (m_ipv4AddressEntry.erase (dst) != 0)
+  const Bucket &bucket = m_buckets[FindBucket (dst.Get ())];
+  if (bucket.pos == 0)
     {
-      // NS_LOG_DEBUG("Route erased");
-      return true;
+      return false;
     }
-  return false;
+  Erase (bucket.pos - 1);
+  return true;
 }
 
 uint32_t
-RoutingTable::RoutingTableSize ()
+RoutingTable::RoutingTableSize () const
 {
-  return m_ipv4AddressEntry.size ();
+  return m_entries.size ();
 }
 
 bool
 RoutingTable::AddRoute (RoutingTableEntry & rt)
 {
-  std::pair<std::map<Ipv4Address, RoutingTableEntry>::iterator, bool> result = m_ipv4AddressEntry.insert (std::make_pair (
-                                                                                                            rt.GetDestination (),rt));
-  return result.second;
+  uint32_t key = rt.GetDestination ().Get ();
+  uint32_t b = FindBucket (key);
+  if (m_buckets[b].pos != 0)
+    {
+      return false;
+    }
+  m_entries.push_back (rt);
+  m_keys.push_back (key);
+  m_buckets[b].key = key;
+  m_buckets[b].pos = m_entries.size ();
+  if (2 * m_entries.size () > m_buckets.size ())
+    {
+      Grow ();
+    }
+  return true;
 }
 
 bool
 RoutingTable::Update (RoutingTableEntry & rt)
 {
-  std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.find (rt.GetDestination ());
-  if (i == m_ipv4AddressEntry.end ())
+  const Bucket &bucket = m_buckets[FindBucket (rt.GetDestination ().Get ())];
+  if (bucket.pos == 0)
     {
       return false;
     }
-  i->second = rt;
+  m_entries[bucket.pos - 1] = rt;
+  return true;
+}
+
+bool
+RoutingTable::RefreshRoute (Ptr<NetDevice> dev, Ipv4Address dst,
+                            Ipv4InterfaceAddress iface, Ipv4Address nextHop)
+{
+  const Bucket &bucket = m_buckets[FindBucket (dst.Get ())];
+  if (bucket.pos == 0)
+    {
+      RoutingTableEntry rt (dev, dst, iface, nextHop);
+      rt.SetEpoch (m_epoch);
+      if (m_holddownTime.IsStrictlyPositive ())
+        {
+          ArmExpiry (rt);
+        }
+      return AddRoute (rt);
+    }
+  RoutingTableEntry &rt = m_entries[bucket.pos - 1];
+  rt.SetInterface (iface);
+  rt.GetRoute ()->SetSource (iface.GetLocal ());
+  rt.SetNextHop (nextHop);
+  rt.SetOutputDevice (dev);
+  rt.SetFlag (VALID);
+  rt.SetEpoch (m_epoch);
+  if (m_holddownTime.IsStrictlyPositive ())
+    {
+      ArmExpiry (rt);
+    }
+  return false;
+}
+
+bool
+RoutingTable::Touch (Ipv4Address dst)
+{
+  const Bucket &bucket = m_buckets[FindBucket (dst.Get ())];
+  if (bucket.pos == 0)
+    {
+      return false;
+    }
+  RoutingTableEntry &rt = m_entries[bucket.pos - 1];
+  if (rt.GetEpoch () == 0 || !IsCurrent (rt))
+    {
+      return false;
+    }
+  if (m_holddownTime.IsStrictlyPositive ())
+    {
+      ArmExpiry (rt);
+    }
   return true;
 }
 
 void
-RoutingTable::DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface)
+RoutingTable::NewEpoch ()
 {
-  if (m_ipv4AddressEntry.empty ())
+  // Skip 0 on wrap around, it marks entries that do not go stale
+  if (++m_epoch == 0)
     {
-      return;
+      m_epoch = 1;
     }
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); )
+}
+
+void
+RoutingTable::DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface)
+{
+  for (uint32_t i = 0; i < m_entries.size (); )
     {
-      if (i->second.GetInterface () == iface)
+      if (m_entries[i].GetInterface () == iface)
         {
-          std::map<Ipv4Address, RoutingTableEntry>::iterator tmp = i;
-          ++i;
-          m_ipv4AddressEntry.erase (tmp);
+          // The last entry moves to i
+          Erase (i);
         }
       else
         {
@@ -161,12 +451,13 @@ RoutingTable::DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface)
 void
 RoutingTable::GetListOfAllRoutes (std::map<Ipv4Address, RoutingTableEntry> & allRoutes)
 {
-  for (std::map<Ipv4Address, RoutingTableEntry>::iterator i = m_ipv4AddressEntry.begin (); i != m_ipv4AddressEntry.end (); ++i)
+  for (uint32_t i = 0; i < m_entries.size (); ++i)
     {
-      if (i->second.GetDestination () != Ipv4Address ("127.0.0.1") && i->second.GetFlag () == VALID)
+      if (m_entries[i].GetDestination () != Ipv4Address ("127.0.0.1") && m_entries[i].GetFlag () == VALID
+          && IsCurrent (m_entries[i]))
         {
           allRoutes.insert (
-            std::make_pair (i->first,i->second));
+            std::make_pair (Ipv4Address (m_keys[i]),m_entries[i]));
         }
     }
 }
@@ -176,12 +467,11 @@ RoutingTable::GetListOfDestinationWithNextHop (Ipv4Address nextHop,
                                                std::map<Ipv4Address, RoutingTableEntry> & unreachable)
 {
   unreachable.clear ();
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.begin (); i
-       != m_ipv4AddressEntry.end (); ++i)
+  for (uint32_t i = 0; i < m_entries.size (); ++i)
     {
-      if (i->second.GetNextHop () == nextHop)
+      if (m_entries[i].GetNextHop () == nextHop && IsCurrent (m_entries[i]))
         {
-          unreachable.insert (std::make_pair (i->first,i->second));
+          unreachable.insert (std::make_pair (Ipv4Address (m_keys[i]),m_entries[i]));
         }
     }
 }
@@ -198,12 +488,11 @@ RoutingTable::Print (Ptr<OutputStreamWrapper> stream) const
 {
   
   *stream->GetStream () << "\nLEACH Routing table\n" << "DST\t\t\tDestination\t\tGateway\t\t\tInterface\n";
-  for (std::map<Ipv4Address, RoutingTableEntry>::const_iterator i = m_ipv4AddressEntry.begin (); i
-       != m_ipv4AddressEntry.end (); ++i)
+  for (uint32_t i = 0; i < m_entries.size (); ++i)
     {
-      i->first.Print (*stream->GetStream());
+      Ipv4Address (m_keys[i]).Print (*stream->GetStream());
       *stream->GetStream() << "\t\t";
-      i->second.Print (stream);
+      m_entries[i].Print (stream);
     }
   *stream->GetStream () << "\n";
 }
@@ -34,10 +34,12 @@
 
 #include <cassert>
 #include <map>
+#include <vector>
 #include <sys/types.h>
 #include "ns3/ipv4.h"
 #include "ns3/ipv4-route.h"
 #include "ns3/timer.h"
+#include "ns3/callback.h"
 #include "ns3/net-device.h"
 #include "ns3/output-stream-wrapper.h"
 
@@ -71,6 +73,8 @@ public:
     m_ipv4Route->SetSource (m_iface.GetLocal ());
     m_ipv4Route->SetOutputDevice (0);
     m_flag = VALID;
+    m_epoch = 0;
+    m_expiryTick = 0;
   }
   void
   Copy(RoutingTableEntry from)
@@ -81,6 +85,7 @@ public:
     m_ipv4Route->SetSource (from.GetRoute()->GetSource ());
     m_ipv4Route->SetOutputDevice (from.GetRoute()->GetOutputDevice());
     m_flag = from.GetFlag ();
+    m_epoch = from.GetEpoch ();
   }
   
   Ipv4Address
@@ -143,6 +148,39 @@ public:
   {
     return m_flag;
   }
+  /// Round the entry belongs to, 0 if it outlives rounds
+  void
+  SetEpoch (uint32_t epoch)
+  {
+    m_epoch = epoch;
+  }
+  uint32_t
+  GetEpoch () const
+  {
+    return m_epoch;
+  }
+  /// Time a round entry expires, if the table has a holddown time
+  void
+  SetExpireTime (Time t)
+  {
+    m_expire = t;
+  }
+  Time
+  GetExpireTime () const
+  {
+    return m_expire;
+  }
+  /// Tick of the pending expiry of the entry in the wheel of its table, 0 if none
+  void
+  SetExpiryTick (uint64_t tick)
+  {
+    m_expiryTick = tick;
+  }
+  uint64_t
+  GetExpiryTick () const
+  {
+    return m_expiryTick;
+  }
   /**
    * \brief Compare destination address
    * \return true if equal
@@ -169,18 +207,42 @@ private:
   Ipv4InterfaceAddress m_iface;
   /// Routing flags: valid, invalid or in search
   RouteFlags m_flag;
+  /// Round the entry belongs to, 0 if it outlives rounds
+  uint32_t m_epoch;
+  /// Time the entry expires, if it belongs to a round
+  Time m_expire;
+  /// Tick of its pending expiry, 0 if none
+  uint64_t m_expiryTick;
   
 };
 
 /**
  * \ingroup leach
  * \brief The Routing table used by LEACH protocol
+ *
+ * Entries are stored densely, and indexed by an open addressing hash table
+ * keyed on the 32 bit destination address, with linear probing and
+ * backward shift deletion.  The index is kept at most half full.
+ *
+ * Entries set up with RefreshRoute belong to the current epoch.  NewEpoch
+ * makes them stale at once: they are no longer found, but stay in place
+ * with their Ipv4Route until RefreshRoute brings them back.  Other entries
+ * have epoch 0 and never go stale.
+ *
+ * With a holddown time set, an entry also goes stale holddown after it was
+ * last refreshed or touched, and the expire callback is told.  Expiry
+ * times are kept in a two level timing wheel of 64 slots per level,
+ * advanced by a single event per tick of a sixteenth of the holddown time,
+ * and only while some entry is due to expire.  Each entry has at most one
+ * item in the wheel; an item that fires before the entry is due is filed
+ * again for its new expiry time.
  */
 class RoutingTable
 {
 public:
   /// c-tor
   RoutingTable ();
+  ~RoutingTable ();
   /**
    * Add routing table entry if it doesn't yet exist in routing table
    * \param r routing table entry
@@ -205,6 +267,13 @@ public:
   LookupRoute (Ipv4Address dst, RoutingTableEntry & rt);
   bool
   LookupRoute (Ipv4Address id, RoutingTableEntry & rt, bool forRouteInput);
+  /**
+   * Lookup routing table entry with destination address dst, without copying it
+   * \param dst destination address
+   * \return the entry, or 0; valid until the table is next modified
+   */
+  const RoutingTableEntry *
+  LookupRoute (Ipv4Address dst) const;
   /**
    * Updating the routing Table with routing table entry rt
    * \param rt routing table entry
@@ -212,6 +281,34 @@ public:
    */
   bool
   Update (RoutingTableEntry & rt);
+  /**
+   * Point the route to dst at nextHop for the current epoch.  A stale or
+   * current entry for dst is updated in place, keeping its Ipv4Route.
+   * \return true if a new entry was added
+   */
+  bool
+  RefreshRoute (Ptr<NetDevice> dev, Ipv4Address dst, Ipv4InterfaceAddress iface, Ipv4Address nextHop);
+  /**
+   * Push back the expiry of the current round entry for dst by the holddown
+   * time, e.g. as its next hop was heard from
+   * \return false if there is no current round entry for dst
+   */
+  bool
+  Touch (Ipv4Address dst);
+  /// Set the callback told the destination of each entry that expires
+  void
+  SetExpireCallback (Callback<void, Ipv4Address> cb)
+  {
+    m_expireCallback = cb;
+  }
+  /// Make the entries of the current epoch stale
+  void
+  NewEpoch ();
+  uint32_t
+  GetEpoch () const
+  {
+    return m_epoch;
+  }
   /**
    * Lookup list of addresses for which nxtHp is the next Hop address
    * \param nxtHp nexthop's address for which we want the list of destinations
@@ -230,16 +327,13 @@ public:
   DeleteAllRoutesFromInterface (Ipv4InterfaceAddress iface);
   /// Delete all entries from routing table
   void
-  Clear ()
-  {
-    m_ipv4AddressEntry.clear ();
-  }
+  Clear ();
   /// Print routing table
   void
   Print (Ptr<OutputStreamWrapper> stream) const;
-  /// Provides the number of routes present in that nodes routing table.
+  /// Provides the number of routes present in that nodes routing table, stale ones included.
   uint32_t
-  RoutingTableSize ();
+  RoutingTableSize () const;
   /**
   * Add an event for a destination address so that the update to for that destination is sent
   * after the event is completed.
@@ -284,16 +378,90 @@ public:
   {
     return m_holddownTime;
   }
-  void Setholddowntime (Time t)
+  /// Time a round entry stays current after RefreshRoute, zero for no limit
+  void Setholddowntime (Time t);
+
+private:
+  /// Bucket of the hash index
+  struct Bucket
+  {
+    uint32_t key; ///< destination address
+    uint32_t pos; ///< index in m_entries plus one, 0 if free
+  };
+  /// Bucket a key hashes to
+  uint32_t
+  Home (uint32_t key) const
+  {
+    return (key * 2654435769u) >> m_shift;
+  }
+  /// Whether entry is found by lookups
+  bool
+  IsCurrent (const RoutingTableEntry &entry) const
   {
-    m_holddownTime = t;
+    return entry.GetEpoch () == 0 || (entry.GetEpoch () == m_epoch && entry.GetFlag () == VALID);
   }
+  /// Slots per level of the expiry wheel
+  static const uint32_t WHEEL_SLOTS = 64;
+  /// Expiry of an entry, pending in the wheel
+  struct WheelItem
+  {
+    uint32_t key; ///< destination address
+    uint64_t tick; ///< tick the entry expires at
+  };
+  /// Tick time t falls in, rounded up
+  uint64_t
+  GetTick (Time t) const;
+  /**
+   * Add an expiry for key at time expire, and start the wheel
+   * \return the tick the item was filed at
+   */
+  uint64_t
+  ScheduleExpiry (uint32_t key, Time expire);
+  /// Set rt to expire holddown from now, filing an item unless it has one
+  void
+  ArmExpiry (RoutingTableEntry &rt);
+  /// Put item in the level and slot matching its distance from m_wheelNow
+  void
+  Place (const WheelItem &item);
+  /// Advance the wheel up to the current time, expiring due entries
+  void
+  Tick ();
+  /// Invalidate the entry of item, unless it was refreshed since
+  void
+  ExpireRoute (const WheelItem &item);
+  /// Bucket holding key, or the free bucket ending its probe sequence
+  uint32_t
+  FindBucket (uint32_t key) const;
+  /// Remove entry pos, moving the last entry in its place
+  void
+  Erase (uint32_t pos);
+  /// Double the index
+  void
+  Grow ();
 
-private:
-  
   // Fields
-  /// an entry in the routing table.
-  std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;
+  /// Routing table entries, in no particular order
+  std::vector<RoutingTableEntry> m_entries;
+  /// Destination address of each entry in m_entries, as added
+  std::vector<uint32_t> m_keys;
+  /// Hash index into m_entries; its size is a power of two
+  std::vector<Bucket> m_buckets;
+  /// 32 minus log2 of the index size
+  uint32_t m_shift;
+  /// Current epoch, never 0
+  uint32_t m_epoch;
+  /// Expiry wheel: level 0 slots span a tick, level 1 slots WHEEL_SLOTS ticks
+  std::vector<WheelItem> m_wheel[2][WHEEL_SLOTS];
+  /// Last tick the wheel was advanced to
+  uint64_t m_wheelNow;
+  /// Items in the wheel
+  uint32_t m_wheelItems;
+  /// Time a tick of the wheel lasts
+  Time m_tick;
+  /// Next tick of the wheel, running while it holds items
+  EventId m_wheelEvent;
+  /// Told the destination of each entry that expires
+  Callback<void, Ipv4Address> m_expireCallback;
   /// an entry in the event table.
   std::map<Ipv4Address, EventId> m_ipv4Events;
   ///
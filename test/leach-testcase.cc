@@ -44,7 +44,20 @@
 #include "ns3/internet-stack-helper.h"
 #include "ns3/ipv4-address-helper.h"
 #include "ns3/leach-packet.h"
+#include "ns3/leach-aggregate.h"
+#include "ns3/leach-reassembly-cache.h"
+#include "ns3/leach-rate-estimator.h"
 #include "ns3/leach-rtable.h"
+#include "ns3/leach-packet-queue.h"
+#include "ns3/leach-opttm-solver.h"
+#include "ns3/leach-aggregation-policy.h"
+#include "ns3/leach-policy-library.h"
+#include "ns3/leach-cluster-partition.h"
+#include "ns3/leach-routing-protocol.h"
+#include "ns3/simple-net-device-helper.h"
+#include "ns3/simple-net-device.h"
+#include "ns3/error-model.h"
+#include "ns3/enum.h"
 #include "ns3/vector.h"
 
 using namespace ns3;
@@ -94,6 +107,43 @@ LeachHeaderTestCase::DoRun ()
     NS_TEST_ASSERT_MSG_EQ (hdr1.GetSerializedSize (),12,"004");
     NS_TEST_ASSERT_MSG_EQ (hdr1.GetPosition (), Vector(1.0, 1.0, 2.0),"005");
   }
+
+  {
+    leach::ClusterScheduleHeader schedule (MilliSeconds (5), MilliSeconds (10));
+    schedule.AddSlot (Ipv4Address ("10.1.1.7"));
+    schedule.AddSlot (Ipv4Address ("10.1.1.3"));
+    packet->AddHeader (schedule);
+    NS_TEST_ASSERT_MSG_EQ (packet->GetSize (), 10 + 2 * 4, "006");
+    leach::ClusterScheduleHeader received;
+    packet->RemoveHeader (received);
+    NS_TEST_ASSERT_MSG_EQ (received.GetStart (), MilliSeconds (5), "007");
+    NS_TEST_ASSERT_MSG_EQ (received.GetSlot (), MilliSeconds (10), "008");
+    uint32_t slot;
+    NS_TEST_ASSERT_MSG_EQ (received.Find (Ipv4Address ("10.1.1.3"), slot), true, "009");
+    NS_TEST_ASSERT_MSG_EQ (slot, 1, "010");
+    NS_TEST_ASSERT_MSG_EQ (received.Find (Ipv4Address ("10.1.1.2"), slot), false, "011");
+  }
+
+  {
+    packet->AddHeader (leach::LeachControlHeader (leach::LeachControlHeader::JOIN));
+    packet->AddHeader (leach::LeachControlHeader (leach::LeachControlHeader::ADV, Vector (2.5, 7, 0)));
+    NS_TEST_ASSERT_MSG_EQ (packet->GetSize (), 17 + 1, "012");
+    leach::LeachControlHeader adv;
+    packet->RemoveHeader (adv);
+    NS_TEST_ASSERT_MSG_EQ (adv.IsValid (), true, "013");
+    NS_TEST_ASSERT_MSG_EQ (adv.GetType (), leach::LeachControlHeader::ADV, "014");
+    NS_TEST_ASSERT_MSG_EQ (adv.GetPosition (), Vector (2.5, 7, 0), "015");
+    leach::LeachControlHeader join;
+    packet->RemoveHeader (join);
+    NS_TEST_ASSERT_MSG_EQ (join.GetType (), leach::LeachControlHeader::JOIN, "016");
+    NS_TEST_ASSERT_MSG_EQ (packet->GetSize (), 0, "017");
+
+    uint8_t unknown = 99;
+    Ptr<Packet> bad = Create<Packet> (&unknown, 1);
+    leach::LeachControlHeader control;
+    bad->RemoveHeader (control);
+    NS_TEST_ASSERT_MSG_EQ (control.IsValid (), false, "018");
+  }
 }
 
 class LeachTableTestCase : public TestCase
@@ -164,6 +214,1012 @@ LeachTableTestCase::DoRun ()
     NS_TEST_ASSERT_MSG_EQ (rEntry.GetInterface ().GetBroadcast (),Ipv4Address ("10.1.1.255"),"108");
     NS_TEST_ASSERT_MSG_EQ (rtable.RoutingTableSize (),4,"Rtable size incorrect");
   }
+  {
+    // Enough entries to grow the index, then delete every other one
+    for (uint32_t i = 0; i < 1000; i++)
+      {
+        leach::RoutingTableEntry rEntry (
+          /*device=*/ dev, /*dst=*/ Ipv4Address (0x0a020000 + i),
+          /*iface=*/ Ipv4InterfaceAddress (Ipv4Address ("10.1.1.1"), Ipv4Mask ("255.255.255.0")),
+          /*next hop=*/ Ipv4Address ("10.1.1.2"));
+        rtable.AddRoute (rEntry);
+      }
+    NS_TEST_ASSERT_MSG_EQ (rtable.RoutingTableSize (),1004,"Rtable size after growth");
+    for (uint32_t i = 0; i < 1000; i += 2)
+      {
+        NS_TEST_ASSERT_MSG_EQ (rtable.DeleteRoute (Ipv4Address (0x0a020000 + i)),true,"delete route");
+      }
+    NS_TEST_ASSERT_MSG_EQ (rtable.DeleteRoute (Ipv4Address (0x0a020000)),false,"delete twice");
+    for (uint32_t i = 0; i < 1000; i++)
+      {
+        const leach::RoutingTableEntry *entry = rtable.LookupRoute (Ipv4Address (0x0a020000 + i));
+        NS_TEST_ASSERT_MSG_EQ ((entry != 0), (i % 2 == 1),"lookup after delete");
+        if (entry)
+          {
+            NS_TEST_ASSERT_MSG_EQ (entry->GetDestination (),Ipv4Address (0x0a020000 + i),"entry moved with its key");
+          }
+      }
+    NS_TEST_ASSERT_MSG_EQ (rtable.RoutingTableSize (),504,"Rtable size after delete");
+    NS_TEST_ASSERT_MSG_EQ ((rtable.LookupRoute (Ipv4Address ("10.1.1.4")) != 0),true,"old route kept");
+  }
+  {
+    // Round routes go stale on a new epoch, and come back in place
+    Ipv4InterfaceAddress iface (Ipv4Address ("10.1.1.1"), Ipv4Mask ("255.255.255.0"));
+    NS_TEST_ASSERT_MSG_EQ (rtable.RefreshRoute (dev, Ipv4Address ("10.1.2.1"), iface, Ipv4Address ("10.1.1.7")),true,"refresh adds");
+    Ptr<Ipv4Route> route = rtable.LookupRoute (Ipv4Address ("10.1.2.1"))->GetRoute ();
+    uint32_t size = rtable.RoutingTableSize ();
+    rtable.NewEpoch ();
+    NS_TEST_ASSERT_MSG_EQ ((rtable.LookupRoute (Ipv4Address ("10.1.2.1")) == 0),true,"stale route hidden");
+    NS_TEST_ASSERT_MSG_EQ ((rtable.LookupRoute (Ipv4Address ("10.1.1.4")) != 0),true,"epoch 0 route kept");
+    NS_TEST_ASSERT_MSG_EQ (rtable.RefreshRoute (dev, Ipv4Address ("10.1.2.1"), iface, Ipv4Address ("10.1.1.8")),false,"refresh in place");
+    const leach::RoutingTableEntry *entry = rtable.LookupRoute (Ipv4Address ("10.1.2.1"));
+    NS_TEST_ASSERT_MSG_EQ ((entry != 0),true,"refreshed route found");
+    NS_TEST_ASSERT_MSG_EQ (entry->GetNextHop (),Ipv4Address ("10.1.1.8"),"refreshed next hop");
+    NS_TEST_ASSERT_MSG_EQ ((entry->GetRoute () == route),true,"Ipv4Route reused");
+    NS_TEST_ASSERT_MSG_EQ (rtable.RoutingTableSize (),size,"no entry added");
+  }
+  Simulator::Destroy ();
+}
+
+class LeachPacketQueueTestCase : public TestCase
+{
+public:
+  LeachPacketQueueTestCase ();
+  ~LeachPacketQueueTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachPacketQueueTestCase::LeachPacketQueueTestCase ()
+  : TestCase ("Leach packet queue deadline index")
+{
+}
+LeachPacketQueueTestCase::~LeachPacketQueueTestCase ()
+{
+}
+void
+LeachPacketQueueTestCase::DoRun ()
+{
+  leach::PacketQueue queue;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  // enqueued out of deadline order
+  double deadlines[] = { 3.0, 1.0, 4.0, 2.0, 5.0 };
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      Ptr<Packet> packet = Create<Packet> (16);
+      leach::LeachHeader hdr;
+      hdr.SetDeadline (Seconds (deadlines[i]));
+      packet->AddHeader (hdr);
+      leach::QueueEntry entry (packet, header);
+      queue.Enqueue (entry);
+    }
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 5, "Queue size incorrect");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetDeadline (0), Seconds (1.0), "Earliest deadline");
+  NS_TEST_ASSERT_MSG_EQ (queue.CountDueBefore (Seconds (3.5)), 3, "Due before 3.5s");
+  NS_TEST_ASSERT_MSG_EQ (queue.PurgeExpired (Seconds (2.5)), 2, "Purge before 2.5s");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 3, "Queue size after purge");
+  NS_TEST_ASSERT_MSG_EQ (queue.CountDueBefore (Seconds (3.5)), 1, "Due before 3.5s after purge");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSlack (Seconds (3.5)), 2000, "Slack at 3.5s");
+
+  // Dequeue keeps arrival order
+  leach::QueueEntry entry;
+  NS_TEST_ASSERT_MSG_EQ (queue.Dequeue (Ipv4Address ("10.1.1.1"), entry), true, "Dequeue");
+  NS_TEST_ASSERT_MSG_EQ (entry.GetDeadline (), Seconds (3.0), "First arrival left");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetDeadline (0), Seconds (4.0), "Index follows dequeue");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 2, "Queue size after dequeue");
+
+  // Per-destination FIFOs
+  header.SetDestination (Ipv4Address ("10.1.1.2"));
+  Ptr<Packet> packet = Create<Packet> (16);
+  leach::LeachHeader hdr;
+  hdr.SetDeadline (Seconds (4.5));
+  packet->AddHeader (hdr);
+  leach::QueueEntry other (packet, header);
+  queue.Enqueue (other);
+  NS_TEST_ASSERT_MSG_EQ (queue.GetCountForPacketsWithDst (Ipv4Address ("10.1.1.1")), 2, "Count for sink");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetCountForPacketsWithDst (Ipv4Address ("10.1.1.2")), 1, "Count for other");
+
+  std::list<leach::QueueEntry> entries;
+  NS_TEST_ASSERT_MSG_EQ (queue.DequeueAll (Ipv4Address ("10.1.1.1"), entries), 2, "DequeueAll");
+  NS_TEST_ASSERT_MSG_EQ (entries.front ().GetDeadline (), Seconds (4.0), "DequeueAll keeps arrival order");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 1, "Queue size after DequeueAll");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetDeadline (0), Seconds (4.5), "Index follows DequeueAll");
+  NS_TEST_ASSERT_MSG_EQ (queue.Find (Ipv4Address ("10.1.1.1")), false, "Sink FIFO empty");
+
+  // Recycled nodes carry the next entries
+  queue.Recycle (entries);
+  NS_TEST_ASSERT_MSG_EQ (entries.empty (), true, "Recycle takes the nodes");
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  leach::QueueEntry again (packet, header);
+  queue.Enqueue (again);
+  NS_TEST_ASSERT_MSG_EQ (queue.GetCountForPacketsWithDst (Ipv4Address ("10.1.1.1")), 1, "Enqueue after Recycle");
+  NS_TEST_ASSERT_MSG_EQ (queue.Dequeue (Ipv4Address ("10.1.1.1"), entry), true, "Dequeue recycled node");
+  NS_TEST_ASSERT_MSG_EQ ((entry.GetPacket () == packet), true, "Recycled node holds the new entry");
+}
+
+class LeachDeferredQueueTestCase : public TestCase
+{
+public:
+  LeachDeferredQueueTestCase ();
+  ~LeachDeferredQueueTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachDeferredQueueTestCase::LeachDeferredQueueTestCase ()
+  : TestCase ("Leach deferred queue ring buffer")
+{
+}
+LeachDeferredQueueTestCase::~LeachDeferredQueueTestCase ()
+{
+}
+void
+LeachDeferredQueueTestCase::DoRun ()
+{
+  leach::DeferredQueue queue (3);
+  Ptr<Packet> packets[5];
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      packets[i] = Create<Packet> (10 + i);
+      leach::DeferredQueue::Entry entry;
+      entry.packet = packets[i];
+      entry.retries = i;
+      NS_TEST_ASSERT_MSG_EQ (queue.Enqueue (entry), i < 3, "Drop oldest when full");
+    }
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 3, "Queue size");
+  NS_TEST_ASSERT_MSG_EQ (queue.Front ().packet, packets[2], "Oldest kept entry");
+
+  // Shrinking keeps the newest entries, in order
+  queue.SetMaxQueueLen (2);
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 2, "Queue size after shrink");
+  NS_TEST_ASSERT_MSG_EQ (queue.Front ().packet, packets[3], "Oldest after shrink");
+  queue.Pop ();
+  NS_TEST_ASSERT_MSG_EQ (queue.Front ().retries, 4, "Next entry");
+  queue.Pop ();
+  NS_TEST_ASSERT_MSG_EQ (queue.IsEmpty (), true, "Queue empty");
+}
+
+class LeachOptTmSolverTestCase : public TestCase
+{
+public:
+  LeachOptTmSolverTestCase ();
+  ~LeachOptTmSolverTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachOptTmSolverTestCase::LeachOptTmSolverTestCase ()
+  : TestCase ("Leach OptTM stopping rule")
+{
+}
+LeachOptTmSolverTestCase::~LeachOptTmSolverTestCase ()
+{
+}
+void
+LeachOptTmSolverTestCase::DoRun ()
+{
+  leach::PacketQueue queue;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  for (uint32_t i = 0; i < 16; i++)
+    {
+      Ptr<Packet> packet = Create<Packet> (16);
+      leach::LeachHeader hdr;
+      hdr.SetDeadline (Seconds (20.0));
+      packet->AddHeader (hdr);
+      leach::QueueEntry entry (packet, header);
+      queue.Enqueue (entry);
+    }
+
+  // At one arrival per second, waiting four arrivals gains a bonus of 66000
+  // and loses 4000 ms of slack per entry, so 16 entries wait
+  leach::OptTmSolver solver;
+  NS_TEST_ASSERT_MSG_EQ (solver.Decide (queue, Seconds (0), 1.0), false, "16 entries wait");
+
+  // An entry expiring before the next arrival loses only its own slack
+  double deadlines[] = { 0.5, 20.0 };
+  bool expected[] = { false, true };
+  for (uint32_t i = 0; i < 2; i++)
+    {
+      Ptr<Packet> packet = Create<Packet> (16);
+      leach::LeachHeader hdr;
+      hdr.SetDeadline (Seconds (deadlines[i]));
+      packet->AddHeader (hdr);
+      leach::QueueEntry entry (packet, header);
+      queue.Enqueue (entry);
+      solver.Reset ();
+      NS_TEST_ASSERT_MSG_EQ (solver.Decide (queue, Seconds (0), 1.0), expected[i], "Decision at step 0");
+    }
+
+  // Once the bonus stops growing there is nothing left to wait for
+  leach::PacketQueue empty;
+  solver.Reset ();
+  for (uint32_t i = 0; i < leach::OptTmSolver::BONUS_STEPS; i++)
+    {
+      solver.Decide (empty, Seconds (0), 1.0);
+    }
+  NS_TEST_ASSERT_MSG_EQ (solver.Decide (empty, Seconds (0), 1.0), true, "Transmit after the bonus steps");
+}
+
+class LeachAggregateTestCase : public TestCase
+{
+public:
+  LeachAggregateTestCase ();
+  ~LeachAggregateTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachAggregateTestCase::LeachAggregateTestCase ()
+  : TestCase ("Leach aggregate frame encoding")
+{
+}
+LeachAggregateTestCase::~LeachAggregateTestCase ()
+{
+}
+void
+LeachAggregateTestCase::DoRun ()
+{
+  // Readings of different sizes
+  uint32_t sizes[] = { 16, 4, 100 };
+  Ptr<Packet> readings[3];
+  for (uint32_t i = 0; i < 3; i++)
+    {
+      readings[i] = Create<Packet> (sizes[i]);
+      leach::LeachHeader hdr;
+      hdr.SetDeadline (Seconds (i + 1));
+      readings[i]->AddHeader (hdr);
+    }
+  uint32_t records = readings[0]->GetSize () + readings[1]->GetSize () + readings[2]->GetSize ();
+
+  Ptr<Packet> frame = readings[0]->Copy ();
+  leach::AggregateEncoder encoder (frame, Seconds (1));
+  NS_TEST_ASSERT_MSG_EQ (encoder.GetSizeAfter (readings[1]->GetSize ()),
+                         leach::AggregateHeader::GetSerializedSize (2) + readings[0]->GetSize () + readings[1]->GetSize (),
+                         "Size after the next record");
+  encoder.Add (readings[1], Seconds (2));
+  encoder.Add (readings[2], Seconds (3));
+  NS_TEST_ASSERT_MSG_EQ (encoder.GetCount (), 3, "Records added");
+  NS_TEST_ASSERT_MSG_EQ (encoder.GetSize (), leach::AggregateHeader::GetSerializedSize (3) + records, "Frame size");
+  NS_TEST_ASSERT_MSG_EQ (encoder.Finish (), frame, "Frame built in place");
+  NS_TEST_ASSERT_MSG_EQ (frame->GetSize (), leach::AggregateHeader::GetSerializedSize (3) + records, "Frame size");
+
+  leach::AggregateDecoder decoder (frame);
+  NS_TEST_ASSERT_MSG_EQ (decoder.IsValid (), true, "Frame valid");
+  NS_TEST_ASSERT_MSG_EQ (decoder.GetCount (), 3, "Record count");
+  for (int32_t i = 2; i >= 0; i--)
+    {
+      NS_TEST_ASSERT_MSG_EQ (decoder.GetLength (i), readings[i]->GetSize (), "Record length");
+      NS_TEST_ASSERT_MSG_EQ (decoder.GetDeadline (i), Seconds (i + 1), "Record deadline");
+      Ptr<Packet> record = decoder.GetRecord (i);
+      NS_TEST_ASSERT_MSG_EQ (record->GetSize (), readings[i]->GetSize (), "Record size");
+      NS_TEST_ASSERT_MSG_EQ (leach::LeachHeader::PeekDeadline (record), Seconds (i + 1), "Record contents");
+    }
+
+  frame->RemoveAtEnd (1);
+  leach::AggregateDecoder truncated (frame);
+  NS_TEST_ASSERT_MSG_EQ (truncated.IsValid (), false, "Truncated frame");
+}
+
+class LeachCompactAggregateTestCase : public TestCase
+{
+public:
+  LeachCompactAggregateTestCase ();
+  ~LeachCompactAggregateTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachCompactAggregateTestCase::LeachCompactAggregateTestCase ()
+  : TestCase ("Leach compact aggregate encoding")
+{
+}
+LeachCompactAggregateTestCase::~LeachCompactAggregateTestCase ()
+{
+}
+void
+LeachCompactAggregateTestCase::DoRun ()
+{
+  // 20 small readings from 4 members, as a cluster head sees them
+  Ptr<Packet> readings[20];
+  leach::AggregateEncoder plain;
+  leach::AggregateEncoder compact (leach::AggregateHeader::COMPACT);
+  for (uint32_t i = 0; i < 20; i++)
+    {
+      uint32_t member = i % 4;
+      readings[i] = Create<Packet> (4);
+      readings[i]->AddHeader (leach::LeachHeader (Vector (member * 10.0, 5.0, 0.0),
+                                                  Ipv4Address (0x0a010102 + member),
+                                                  Seconds (1) + MilliSeconds (10 * i)));
+      Time deadline = leach::LeachHeader::PeekDeadline (readings[i]);
+      uint32_t expected = compact.GetSizeAfter (readings[i], deadline);
+      compact.Add (readings[i], deadline);
+      NS_TEST_ASSERT_MSG_EQ (compact.GetSize (), expected, "Size after record " << i);
+      plain.Add (readings[i], deadline);
+    }
+  uint32_t plainSize = plain.Finish ()->GetSize ();
+  uint32_t compactSize = compact.GetSize ();
+  Ptr<Packet> frame = compact.Finish ();
+  NS_TEST_ASSERT_MSG_EQ (frame->GetSize (), compactSize, "Frame size");
+  NS_TEST_ASSERT_MSG_LT (frame->GetSize () * 3, plainSize, "Compact frame a third of the plain one");
+
+  leach::AggregateDecoder decoder (frame);
+  NS_TEST_ASSERT_MSG_EQ (decoder.IsValid (), true, "Frame valid");
+  NS_TEST_ASSERT_MSG_EQ (decoder.GetCount (), 20, "Record count");
+  for (uint32_t i = 0; i < 20; i++)
+    {
+      NS_TEST_ASSERT_MSG_EQ (decoder.GetLength (i), readings[i]->GetSize (), "Record length");
+      NS_TEST_ASSERT_MSG_EQ (decoder.GetDeadline (i), Seconds (1) + MilliSeconds (10 * i), "Record deadline");
+      Ptr<Packet> record = decoder.GetRecord (i);
+      NS_TEST_ASSERT_MSG_EQ (record->GetSize (), readings[i]->GetSize (), "Record size");
+      leach::LeachHeader hdr;
+      record->PeekHeader (hdr);
+      NS_TEST_ASSERT_MSG_EQ (hdr.GetAddress (), Ipv4Address (0x0a010102 + i % 4), "Record address");
+      NS_TEST_ASSERT_MSG_EQ (hdr.GetPosition ().x, (i % 4) * 10.0, "Record position");
+      NS_TEST_ASSERT_MSG_EQ (hdr.GetDeadline (), decoder.GetDeadline (i), "Record header deadline");
+    }
+
+  // Built in place, the first reading loses its header to the table
+  Ptr<Packet> first = readings[0]->Copy ();
+  leach::AggregateEncoder inPlace (first, leach::LeachHeader::PeekDeadline (first),
+                                   leach::AggregateHeader::COMPACT);
+  inPlace.Finish ();
+  leach::AggregateDecoder single (first);
+  NS_TEST_ASSERT_MSG_EQ (single.IsValid (), true, "Single record frame valid");
+  NS_TEST_ASSERT_MSG_EQ (single.GetRecord (0)->GetSize (), readings[0]->GetSize (), "Single record size");
+
+  frame->RemoveAtEnd (1);
+  leach::AggregateDecoder truncated (frame);
+  NS_TEST_ASSERT_MSG_EQ (truncated.IsValid (), false, "Truncated frame");
+  Ptr<Packet> table = frame->CreateFragment (0, 20);
+  leach::AggregateDecoder cut (table);
+  NS_TEST_ASSERT_MSG_EQ (cut.IsValid (), false, "Truncated record table");
+}
+
+class LeachPolicyLibraryTestCase : public TestCase
+{
+public:
+  LeachPolicyLibraryTestCase ();
+  ~LeachPolicyLibraryTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachPolicyLibraryTestCase::LeachPolicyLibraryTestCase ()
+  : TestCase ("Leach aggregation rules on both buffer types")
+{
+}
+LeachPolicyLibraryTestCase::~LeachPolicyLibraryTestCase ()
+{
+}
+void
+LeachPolicyLibraryTestCase::DoRun ()
+{
+  leach::DeadlineBuffer<uint32_t> buffer;
+  leach::PacketQueue queue;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  double deadlines[] = { 3.0, 1.0, 4.0, 2.0, 5.0 };
+  for (uint32_t i = 0; i < 5; i++)
+    {
+      buffer.Push (i, Seconds (deadlines[i]));
+      Ptr<Packet> packet = Create<Packet> (16);
+      packet->AddHeader (leach::LeachHeader (Vector (), Ipv4Address (), Seconds (deadlines[i])));
+      leach::QueueEntry entry (packet, header);
+      queue.Enqueue (entry);
+    }
+  NS_TEST_ASSERT_MSG_EQ (buffer.Get (0), 1, "Deadline order");
+  NS_TEST_ASSERT_MSG_EQ (buffer.CountDueBefore (Seconds (3.5)), queue.CountDueBefore (Seconds (3.5)), "Due before 3.5s");
+  NS_TEST_ASSERT_MSG_EQ (buffer.GetSlack (Seconds (3.5)), queue.GetSlack (Seconds (3.5)), "Slack at 3.5s");
+
+  // The same rule decides the same on either buffer
+  leach::AggregationContext ctx;
+  ctx.lambda = 4.0;
+  ctx.clusterHead = true;
+  ctx.members = 2;
+  leach::ProposalRule proposal[2];
+  leach::ControlLimitRule controlLimit[2];
+  uint32_t dropped[2] = { 0, 0 };
+  NS_TEST_ASSERT_MSG_EQ (proposal[0].Decide (buffer, ctx, Seconds (1.5), dropped[0]),
+                         proposal[1].Decide (queue, ctx, Seconds (1.5), dropped[1]), "Proposal");
+  NS_TEST_ASSERT_MSG_EQ (dropped[0], 1, "Expired reading dropped");
+  NS_TEST_ASSERT_MSG_EQ (dropped[1], 1, "Expired reading dropped");
+  NS_TEST_ASSERT_MSG_EQ (controlLimit[0].Decide (buffer, ctx, Seconds (2.5), dropped[0]),
+                         controlLimit[1].Decide (queue, ctx, Seconds (2.5), dropped[1]), "ControlLimit");
+  NS_TEST_ASSERT_MSG_EQ (buffer.GetSize (), 3, "Buffer size after purge");
+  NS_TEST_ASSERT_MSG_EQ (queue.GetSize (), 3, "Queue size after purge");
+}
+
+class LeachReassemblyCacheTestCase : public TestCase
+{
+public:
+  LeachReassemblyCacheTestCase ();
+  ~LeachReassemblyCacheTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachReassemblyCacheTestCase::LeachReassemblyCacheTestCase ()
+  : TestCase ("Leach fragment reassembly cache")
+{
+}
+LeachReassemblyCacheTestCase::~LeachReassemblyCacheTestCase ()
+{
+}
+
+static Ipv4Header
+FragmentHeader (uint16_t id, uint16_t offset, bool last)
+{
+  Ipv4Header header;
+  header.SetSource (Ipv4Address ("10.1.1.2"));
+  header.SetIdentification (id);
+  header.SetFragmentOffset (offset);
+  if (last)
+    {
+      header.SetLastFragment ();
+    }
+  else
+    {
+      header.SetMoreFragments ();
+    }
+  return header;
+}
+
+void
+LeachReassemblyCacheTestCase::DoRun ()
+{
+  leach::ReassemblyCache cache;
+  cache.SetMaxEntries (2);
+  cache.SetMaxBytes (1000);
+  cache.SetTimeout (Seconds (1));
+
+  // Unfragmented datagrams pass through
+  Ptr<Packet> whole = Create<Packet> (100);
+  NS_TEST_ASSERT_MSG_EQ (cache.Add (FragmentHeader (1, 0, true), whole, Seconds (0)), whole, "Unfragmented");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetSize (), 0, "Nothing cached");
+
+  // Out of order fragments, with a gap between 200 and 300
+  NS_TEST_ASSERT_MSG_EQ (cache.Add (FragmentHeader (2, 300, true), Create<Packet> (50), Seconds (0)), 0, "Last fragment first");
+  NS_TEST_ASSERT_MSG_EQ (cache.Add (FragmentHeader (2, 0, false), Create<Packet> (200), Seconds (0)), 0, "First fragment");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetBytes (), 250, "Bytes held");
+  Ptr<Packet> p = cache.Add (FragmentHeader (2, 0, false), Create<Packet> (200), Seconds (0));
+  NS_TEST_ASSERT_MSG_EQ (p, 0, "Duplicate fragment");
+  p = cache.Add (FragmentHeader (3, 0, false), Create<Packet> (200), Seconds (0.5));
+  NS_TEST_ASSERT_MSG_EQ (cache.GetSize (), 2, "Two datagrams");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetMisses (), 2, "Misses");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetHits (), 2, "Hits");
+
+  // Datagram 2 timed out, datagram 3 did not
+  p = cache.Add (FragmentHeader (3, 200, true), Create<Packet> (10), Seconds (1.2));
+  NS_TEST_ASSERT_MSG_EQ (p->GetSize (), 210, "Reassembled");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetEvictions (), 1, "Timeout eviction");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetSize (), 0, "Cache empty");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetBytes (), 0, "No bytes held");
+
+  // Pool and byte cap evict the least recently updated datagram
+  cache.Add (FragmentHeader (4, 0, false), Create<Packet> (400), Seconds (2));
+  cache.Add (FragmentHeader (5, 0, false), Create<Packet> (400), Seconds (2));
+  cache.Add (FragmentHeader (4, 400, false), Create<Packet> (100), Seconds (2));
+  cache.Add (FragmentHeader (6, 0, false), Create<Packet> (100), Seconds (2));
+  NS_TEST_ASSERT_MSG_EQ (cache.GetEvictions (), 2, "Pool eviction");
+  cache.Add (FragmentHeader (6, 100, false), Create<Packet> (600), Seconds (2));
+  NS_TEST_ASSERT_MSG_EQ (cache.GetEvictions (), 3, "Byte cap eviction");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetSize (), 1, "Newest datagram kept");
+  NS_TEST_ASSERT_MSG_EQ (cache.GetBytes (), 700, "Bytes after eviction");
+}
+
+class LeachRateEstimatorTestCase : public TestCase
+{
+public:
+  LeachRateEstimatorTestCase ();
+  ~LeachRateEstimatorTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachRateEstimatorTestCase::LeachRateEstimatorTestCase ()
+  : TestCase ("Leach arrival rate estimator")
+{
+}
+LeachRateEstimatorTestCase::~LeachRateEstimatorTestCase ()
+{
+}
+void
+LeachRateEstimatorTestCase::DoRun ()
+{
+  leach::RateEstimator estimator;
+  estimator.SetPrior (2.0);
+  estimator.SetWeight (0.5);
+  NS_TEST_ASSERT_MSG_EQ_TOL (estimator.GetRate (), 2.0, 1e-9, "Prior");
+
+  // The first arrival only starts the first interval
+  estimator.Update (Seconds (10));
+  NS_TEST_ASSERT_MSG_EQ_TOL (estimator.GetRate (), 2.0, 1e-9, "First arrival");
+  estimator.Update (Seconds (10.25));
+  NS_TEST_ASSERT_MSG_EQ_TOL (estimator.GetRate (), 1 / 0.375, 1e-9, "Average of 0.5 s and 0.25 s");
+  for (uint32_t i = 2; i < 40; i++)
+    {
+      estimator.Update (Seconds (10 + i * 0.25));
+    }
+  NS_TEST_ASSERT_MSG_EQ_TOL (estimator.GetRate (), 4.0, 1e-6, "Converged to 4 per second");
+  NS_TEST_ASSERT_MSG_EQ (estimator.GetCount (), 40, "Arrivals");
+
+  // Weight 0 keeps the prior
+  estimator.SetPrior (2.0);
+  estimator.SetWeight (0);
+  estimator.Update (Seconds (20));
+  estimator.Update (Seconds (20.1));
+  NS_TEST_ASSERT_MSG_EQ_TOL (estimator.GetRate (), 2.0, 1e-9, "Static rate");
+}
+
+class LeachSelectiveForwardingTestCase : public TestCase
+{
+public:
+  LeachSelectiveForwardingTestCase ();
+  ~LeachSelectiveForwardingTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachSelectiveForwardingTestCase::LeachSelectiveForwardingTestCase ()
+  : TestCase ("Leach selective forwarding policy")
+{
+}
+LeachSelectiveForwardingTestCase::~LeachSelectiveForwardingTestCase ()
+{
+}
+void
+LeachSelectiveForwardingTestCase::DoRun ()
+{
+  Ptr<leach::SelectiveForwardingPolicy> policy = CreateObject<leach::SelectiveForwardingPolicy> ();
+  policy->SetAttribute ("SpatialWindow", DoubleValue (10.0));
+  leach::AggregationContext ctx;
+  ctx.lambda = 4.0;
+  ctx.clusterHead = true;
+  ctx.members = 3;
+
+  Vector positions[4] = { Vector (0, 0, 0), Vector (3, 4, 0), Vector (20, 0, 0), Vector (6, 9, 0) };
+  bool admitted[4] = { true, false, true, true };
+  for (uint32_t i = 0; i < 4; i++)
+    {
+      Ptr<Packet> p = Create<Packet> (10);
+      p->AddHeader (leach::LeachHeader (positions[i], Ipv4Address ("10.1.1.2"), Seconds (5)));
+      leach::QueueEntry entry (p);
+      NS_TEST_ASSERT_MSG_EQ (policy->Admit (entry, ctx), admitted[i], "Reading " << i);
+    }
+
+  // Members forward everything
+  ctx.clusterHead = false;
+  Ptr<Packet> p = Create<Packet> (10);
+  p->AddHeader (leach::LeachHeader (positions[0], Ipv4Address ("10.1.1.2"), Seconds (5)));
+  leach::QueueEntry entry (p);
+  NS_TEST_ASSERT_MSG_EQ (policy->Admit (entry, ctx), true, "Member");
+}
+
+class LeachRouteExpiryTestCase : public TestCase
+{
+public:
+  LeachRouteExpiryTestCase ();
+  ~LeachRouteExpiryTestCase ();
+  virtual void
+  DoRun (void);
+
+private:
+  void Refresh (Ipv4Address dst);
+  void SetHolddown (Time t);
+  void CheckRoute (Ipv4Address dst, bool current);
+  void
+  CountExpiry (Ipv4Address dst)
+  {
+    m_expired++;
+  }
+  leach::RoutingTable m_rtable;
+  uint32_t m_expired;
+};
+
+LeachRouteExpiryTestCase::LeachRouteExpiryTestCase ()
+  : TestCase ("Leach route expiry wheel"),
+    m_expired (0)
+{
+}
+LeachRouteExpiryTestCase::~LeachRouteExpiryTestCase ()
+{
+}
+void
+LeachRouteExpiryTestCase::Refresh (Ipv4Address dst)
+{
+  m_rtable.RefreshRoute (0, dst, Ipv4InterfaceAddress (Ipv4Address ("10.1.1.1"), Ipv4Mask ("255.255.255.0")),
+                         Ipv4Address ("10.1.1.2"));
+}
+void
+LeachRouteExpiryTestCase::SetHolddown (Time t)
+{
+  m_rtable.Setholddowntime (t);
+}
+void
+LeachRouteExpiryTestCase::CheckRoute (Ipv4Address dst, bool current)
+{
+  NS_TEST_EXPECT_MSG_EQ ((m_rtable.LookupRoute (dst) != 0), current,
+                         "Route to " << dst << " at " << Simulator::Now ().GetSeconds ());
+}
+void
+LeachRouteExpiryTestCase::DoRun ()
+{
+  Ipv4Address a ("10.1.1.4");
+  Ipv4Address b ("10.1.1.5");
+  Ipv4Address c ("10.1.1.6");
+  m_rtable.Setholddowntime (Seconds (1));
+  m_rtable.SetExpireCallback (MakeCallback (&LeachRouteExpiryTestCase::CountExpiry, this));
+  Simulator::Schedule (Seconds (0), &LeachRouteExpiryTestCase::Refresh, this, a);
+  Simulator::Schedule (Seconds (0), &LeachRouteExpiryTestCase::Refresh, this, b);
+  Simulator::Schedule (Seconds (0.5), &LeachRouteExpiryTestCase::Refresh, this, b);
+  Simulator::Schedule (Seconds (0.9), &LeachRouteExpiryTestCase::CheckRoute, this, a, true);
+  Simulator::Schedule (Seconds (1.1), &LeachRouteExpiryTestCase::CheckRoute, this, a, false);
+  Simulator::Schedule (Seconds (1.1), &LeachRouteExpiryTestCase::CheckRoute, this, b, true);
+  Simulator::Schedule (Seconds (1.6), &LeachRouteExpiryTestCase::CheckRoute, this, b, false);
+  // Refreshed in place after it expired
+  Simulator::Schedule (Seconds (1.7), &LeachRouteExpiryTestCase::Refresh, this, a);
+  Simulator::Schedule (Seconds (1.7), &LeachRouteExpiryTestCase::CheckRoute, this, a, true);
+  // With a pending entry the tick stays, so c goes through level 1
+  Simulator::Schedule (Seconds (1.7), &LeachRouteExpiryTestCase::SetHolddown, this, Seconds (10));
+  Simulator::Schedule (Seconds (1.7), &LeachRouteExpiryTestCase::Refresh, this, c);
+  Simulator::Schedule (Seconds (2.8), &LeachRouteExpiryTestCase::CheckRoute, this, a, false);
+  Simulator::Schedule (Seconds (11.6), &LeachRouteExpiryTestCase::CheckRoute, this, c, true);
+  Simulator::Schedule (Seconds (11.8), &LeachRouteExpiryTestCase::CheckRoute, this, c, false);
+  Simulator::Run ();
+  NS_TEST_ASSERT_MSG_EQ (m_rtable.RoutingTableSize (), 3, "Expired entries stay in place");
+  NS_TEST_ASSERT_MSG_EQ (m_expired, 4, "Each expiry told once");
+  Simulator::Destroy ();
+}
+
+class LeachClusterPartitionTestCase : public TestCase
+{
+public:
+  LeachClusterPartitionTestCase ();
+  ~LeachClusterPartitionTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachClusterPartitionTestCase::LeachClusterPartitionTestCase ()
+  : TestCase ("Leach centralized cluster partition")
+{
+}
+LeachClusterPartitionTestCase::~LeachClusterPartitionTestCase ()
+{
+}
+void
+LeachClusterPartitionTestCase::DoRun ()
+{
+  Ptr<UniformRandomVariable> rng = CreateObject<UniformRandomVariable> ();
+  rng->SetStream (1);
+  leach::ClusterPartition partition;
+  // Three groups of five nodes, far apart; the node at each group center is depleted
+  Vector centers[3] = { Vector (0, 0, 0), Vector (100, 0, 0), Vector (0, 100, 0) };
+  double offsets[5][2] = { { 0, 0 }, { 2, 0 }, { -2, 0 }, { 0, 2 }, { 0, -2 } };
+  for (uint32_t g = 0; g < 3; g++)
+    {
+      for (uint32_t j = 0; j < 5; j++)
+        {
+          Vector position (centers[g].x + offsets[j][0], centers[g].y + offsets[j][1], 0);
+          partition.Add (Ipv4Address (0x0a010100 + 5 * g + j + 2), position, j == 0 ? 0.1 : 0.9);
+        }
+    }
+  NS_TEST_ASSERT_MSG_EQ (partition.Partition (3, rng), 3, "Clusters");
+  uint32_t heads = 0;
+  for (uint32_t i = 0; i < 15; i++)
+    {
+      // Nodes of a group share its cluster
+      NS_TEST_ASSERT_MSG_EQ (partition.GetCluster (i), partition.GetCluster (i - i % 5), "Node " << i);
+      if (partition.IsHead (i))
+        {
+          heads++;
+          NS_TEST_ASSERT_MSG_NE (i % 5, 0, "Depleted node " << i << " heads a cluster");
+        }
+    }
+  NS_TEST_ASSERT_MSG_EQ (heads, 3, "One head per cluster");
+  NS_TEST_ASSERT_MSG_NE (partition.GetCluster (0), partition.GetCluster (5), "Groups apart");
+  NS_TEST_ASSERT_MSG_NE (partition.GetCluster (5), partition.GetCluster (10), "Groups apart");
+
+  // The assignment carries the partition
+  leach::ClusterAssignmentHeader assignment;
+  for (uint32_t c = 0; c < partition.GetNClusters (); c++)
+    {
+      assignment.AddHead (partition.GetHead (c));
+    }
+  for (uint32_t i = 0; i < 15; i++)
+    {
+      if (!partition.IsHead (i))
+        {
+          assignment.AddMember (partition.GetAddress (i), partition.GetCluster (i));
+        }
+    }
+  Ptr<Packet> p = Create<Packet> ();
+  p->AddHeader (assignment);
+  NS_TEST_ASSERT_MSG_EQ (p->GetSize (), 3 + 3 * 4 + 12 * 5, "Assignment size");
+  leach::ClusterAssignmentHeader received;
+  p->RemoveHeader (received);
+  for (uint32_t i = 0; i < 15; i++)
+    {
+      uint32_t cluster;
+      NS_TEST_ASSERT_MSG_EQ (received.Find (partition.GetAddress (i), cluster), true, "Node " << i << " assigned");
+      NS_TEST_ASSERT_MSG_EQ (cluster, partition.GetCluster (i), "Node " << i << " cluster");
+    }
+  uint32_t cluster;
+  NS_TEST_ASSERT_MSG_EQ (received.Find (Ipv4Address ("10.1.1.1"), cluster), false, "Sink not assigned");
+
+  // Fewer nodes than clusters
+  partition.Clear ();
+  partition.Add (Ipv4Address ("10.1.1.2"), Vector (0, 0, 0), 1);
+  NS_TEST_ASSERT_MSG_EQ (partition.Partition (3, rng), 1, "Single node");
+  NS_TEST_ASSERT_MSG_EQ (partition.IsHead (0), true, "Single node heads");
+}
+
+class LeachEnergyWeightTestCase : public TestCase
+{
+public:
+  LeachEnergyWeightTestCase ();
+  ~LeachEnergyWeightTestCase ();
+  virtual void
+  DoRun (void);
+};
+
+LeachEnergyWeightTestCase::LeachEnergyWeightTestCase ()
+  : TestCase ("Leach Energy election weight")
+{
+}
+LeachEnergyWeightTestCase::~LeachEnergyWeightTestCase ()
+{
+}
+void
+LeachEnergyWeightTestCase::DoRun ()
+{
+  // Depleted node, cycles of 10 rounds
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (0.1, 0, 10), 0.1, 1e-9, "Fresh head");
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (0.1, 5, 10), 0.55, 1e-9, "Half a cycle");
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (0.1, 9, 10), 0.91, 1e-9, "Rises each round");
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (0.1, 10, 10), 1.0, 1e-9, "Back after a cycle");
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (0.1, 20, 10), 1.0, 1e-9, "Never above classic");
+  NS_TEST_EXPECT_MSG_EQ_TOL (leach::RoutingProtocol::GetEnergyWeight (1.0, 0, 10), 1.0, 1e-9, "Full node");
+  NS_TEST_EXPECT_MSG_LT (leach::RoutingProtocol::GetEnergyWeight (0.1, 3, 10),
+                         leach::RoutingProtocol::GetEnergyWeight (1.0, 3, 10), "Depleted below full");
+}
+
+/**
+ * Sink 10.1.1.1 above a line of three nodes, which LEACH-C puts in a single
+ * cluster headed by the middle one, 10.1.1.3
+ */
+static void
+BuildLeachCluster (LeachHelper leach, NodeContainer &nodes, NetDeviceContainer &devices)
+{
+  Vector positions[] = { Vector (1, 5, 0), Vector (0, 0, 0), Vector (1, 0, 0), Vector (2, 0, 0) };
+  nodes.Create (4);
+  SimpleNetDeviceHelper simple;
+  devices = simple.Install (nodes);
+  leach.Set ("Election", EnumValue (leach::RoutingProtocol::CENTRALIZED));
+  leach.Set ("ClusterCount", UintegerValue (1));
+  leach.Set ("PeriodicUpdateInterval", TimeValue (Seconds (10)));
+  InternetStackHelper stack;
+  for (uint32_t i = 0; i < nodes.GetN (); i++)
+    {
+      leach.Set ("Position", Vector3DValue (positions[i]));
+      stack.SetRoutingHelper (leach);
+      stack.Install (nodes.Get (i));
+    }
+  Ipv4AddressHelper address;
+  address.SetBase ("10.1.1.0", "255.255.255.0");
+  address.Assign (devices);
+}
+
+static Ptr<leach::RoutingProtocol>
+GetLeach (Ptr<Node> node)
+{
+  return DynamicCast<leach::RoutingProtocol> (node->GetObject<Ipv4> ()->GetRoutingProtocol ());
+}
+
+class LeachControlRouteOutputTestCase : public TestCase
+{
+public:
+  LeachControlRouteOutputTestCase ();
+  ~LeachControlRouteOutputTestCase ();
+  virtual void
+  DoRun (void);
+  /// Route a JOIN and an ADV from the member
+  void
+  Check ();
+  void
+  CountTimeline (Time begin, Time end)
+  {
+    m_timeline++;
+  }
+
+private:
+  Ptr<leach::RoutingProtocol> m_member;
+  uint32_t m_timeline;
+};
+
+LeachControlRouteOutputTestCase::LeachControlRouteOutputTestCase ()
+  : TestCase ("Leach control messages through RouteOutput without aggregation"),
+    m_timeline (0)
+{
+}
+LeachControlRouteOutputTestCase::~LeachControlRouteOutputTestCase ()
+{
+}
+void
+LeachControlRouteOutputTestCase::Check ()
+{
+  Socket::SocketErrno err;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.3"));
+  Ptr<Packet> join = Create<Packet> ();
+  join->AddHeader (leach::LeachControlHeader (leach::LeachControlHeader::JOIN));
+  Ptr<Ipv4Route> route = m_member->RouteOutput (join, header, 0, err);
+  NS_TEST_ASSERT_MSG_EQ ((route != 0), true, "JOIN routed");
+  NS_TEST_ASSERT_MSG_EQ (route->GetGateway (), Ipv4Address ("10.1.1.3"), "JOIN to the cluster head");
+
+  header.SetDestination (Ipv4Address ("10.1.1.255"));
+  Ptr<Packet> adv = Create<Packet> ();
+  adv->AddHeader (leach::LeachControlHeader (leach::LeachControlHeader::ADV, Vector (0, 0, 0)));
+  route = m_member->RouteOutput (adv, header, 0, err);
+  NS_TEST_ASSERT_MSG_EQ ((route != 0), true, "ADV routed");
+  NS_TEST_ASSERT_MSG_EQ (route->GetGateway (), Ipv4Address ("10.1.1.255"), "ADV broadcast");
+  NS_TEST_ASSERT_MSG_EQ (m_timeline, 0, "Control messages are not readings");
+}
+void
+LeachControlRouteOutputTestCase::DoRun ()
+{
+  NodeContainer nodes;
+  NetDeviceContainer devices;
+  LeachHelper leach;
+  leach.Set ("AggregationPolicy", TypeIdValue (leach::NoAggregationPolicy::GetTypeId ()));
+  BuildLeachCluster (leach, nodes, devices);
+  m_member = GetLeach (nodes.Get (1));
+  for (uint32_t i = 1; i < nodes.GetN (); i++)
+    {
+      GetLeach (nodes.Get (i))->TraceConnectWithoutContext (
+        "Timeline", MakeCallback (&LeachControlRouteOutputTestCase::CountTimeline, this));
+    }
+  Simulator::Schedule (Seconds (0.5), &LeachControlRouteOutputTestCase::Check, this);
+  Simulator::Stop (Seconds (1));
+  Simulator::Run ();
+  m_member = 0;
+  Simulator::Destroy ();
+}
+
+class LeachReportRouteOutputTestCase : public TestCase
+{
+public:
+  LeachReportRouteOutputTestCase ();
+  ~LeachReportRouteOutputTestCase ();
+  virtual void
+  DoRun (void);
+  /// Route a REPORT from the member
+  void
+  Check ();
+  void
+  CountTimeline (Time begin, Time end)
+  {
+    m_timeline++;
+  }
+
+private:
+  Ptr<leach::RoutingProtocol> m_member;
+  uint32_t m_timeline;
+};
+
+LeachReportRouteOutputTestCase::LeachReportRouteOutputTestCase ()
+  : TestCase ("Leach REPORT to the sink through RouteOutput is no reading"),
+    m_timeline (0)
+{
+}
+LeachReportRouteOutputTestCase::~LeachReportRouteOutputTestCase ()
+{
+}
+void
+LeachReportRouteOutputTestCase::Check ()
+{
+  Socket::SocketErrno err;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  Ptr<Packet> report = Create<Packet> ();
+  report->AddHeader (leach::ClusterReportHeader (Vector (0, 0, 0), 1.0));
+  report->AddHeader (leach::LeachControlHeader (leach::LeachControlHeader::REPORT));
+  report->AddPacketTag (leach::LeachControlTag ());
+  Ptr<Ipv4Route> route = m_member->RouteOutput (report, header, 0, err);
+  NS_TEST_ASSERT_MSG_EQ ((route != 0), true, "REPORT routed");
+  // A reading would be buffered, or go through the cluster head 10.1.1.3
+  NS_TEST_ASSERT_MSG_EQ (route->GetGateway (), Ipv4Address ("10.1.1.1"), "REPORT straight to the sink");
+  NS_TEST_ASSERT_MSG_EQ (m_timeline, 0, "REPORT is not aggregated");
+}
+void
+LeachReportRouteOutputTestCase::DoRun ()
+{
+  NodeContainer nodes;
+  NetDeviceContainer devices;
+  LeachHelper leach;
+  leach.Set ("AggregationPolicy", TypeIdValue (leach::ProposalPolicy::GetTypeId ()));
+  BuildLeachCluster (leach, nodes, devices);
+  m_member = GetLeach (nodes.Get (1));
+  m_member->TraceConnectWithoutContext (
+    "Timeline", MakeCallback (&LeachReportRouteOutputTestCase::CountTimeline, this));
+  Simulator::Schedule (Seconds (0.5), &LeachReportRouteOutputTestCase::Check, this);
+  Simulator::Stop (Seconds (1));
+  Simulator::Run ();
+  m_member = 0;
+  Simulator::Destroy ();
+}
+
+class LeachRouteHolddownTestCase : public TestCase
+{
+public:
+  LeachRouteHolddownTestCase ();
+  ~LeachRouteHolddownTestCase ();
+  virtual void
+  DoRun (void);
+  /// Route a reading from the member, expecting the gateway
+  void
+  CheckReading (Ipv4Address gateway);
+  /// Make the member deaf to the advertisements of its head
+  void
+  Deafen ();
+
+private:
+  Ptr<leach::RoutingProtocol> m_member;
+  Ptr<SimpleNetDevice> m_device;
+};
+
+LeachRouteHolddownTestCase::LeachRouteHolddownTestCase ()
+  : TestCase ("Leach route to a silent cluster head expires mid-round")
+{
+}
+LeachRouteHolddownTestCase::~LeachRouteHolddownTestCase ()
+{
+}
+void
+LeachRouteHolddownTestCase::CheckReading (Ipv4Address gateway)
+{
+  Socket::SocketErrno err;
+  Ipv4Header header;
+  header.SetDestination (Ipv4Address ("10.1.1.1"));
+  Ptr<Packet> reading = Create<Packet> (16);
+  reading->AddHeader (leach::LeachHeader (Vector (), Ipv4Address ("10.1.1.2"), Seconds (5)));
+  Ptr<Ipv4Route> route = m_member->RouteOutput (reading, header, 0, err);
+  NS_TEST_ASSERT_MSG_EQ ((route != 0), true, "Reading routed");
+  NS_TEST_ASSERT_MSG_EQ (route->GetGateway (), gateway,
+                         "Reading at " << Simulator::Now ().GetSeconds ());
+}
+void
+LeachRouteHolddownTestCase::Deafen ()
+{
+  Ptr<RateErrorModel> errors = CreateObject<RateErrorModel> ();
+  errors->SetUnit (RateErrorModel::ERROR_UNIT_PACKET);
+  errors->SetRate (1);
+  m_device->SetReceiveErrorModel (errors);
+}
+void
+LeachRouteHolddownTestCase::DoRun ()
+{
+  NodeContainer nodes;
+  NetDeviceContainer devices;
+  LeachHelper leach;
+  leach.Set ("AggregationPolicy", TypeIdValue (leach::NoAggregationPolicy::GetTypeId ()));
+  leach.Set ("RouteHolddown", TimeValue (MilliSeconds (300)));
+  BuildLeachCluster (leach, nodes, devices);
+  m_member = GetLeach (nodes.Get (1));
+  m_device = DynamicCast<SimpleNetDevice> (devices.Get (1));
+  // Advertisements keep the route up past the holddown after the assignment
+  Simulator::Schedule (Seconds (0.5), &LeachRouteHolddownTestCase::CheckReading, this,
+                       Ipv4Address ("10.1.1.3"));
+  Simulator::Schedule (Seconds (0.55), &LeachRouteHolddownTestCase::Deafen, this);
+  // Well within the round of 10 s, readings are buffered again
+  Simulator::Schedule (Seconds (1), &LeachRouteHolddownTestCase::CheckReading, this,
+                       Ipv4Address ("127.0.0.1"));
+  Simulator::Stop (Seconds (1.1));
+  Simulator::Run ();
+  m_member = 0;
+  m_device = 0;
   Simulator::Destroy ();
 }
 
@@ -174,5 +1230,20 @@ public:
   {
     AddTestCase (new LeachHeaderTestCase (), TestCase::QUICK);
     AddTestCase (new LeachTableTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachPacketQueueTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachDeferredQueueTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachOptTmSolverTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachAggregateTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachCompactAggregateTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachPolicyLibraryTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachReassemblyCacheTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachRateEstimatorTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachSelectiveForwardingTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachRouteExpiryTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachClusterPartitionTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachEnergyWeightTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachControlRouteOutputTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachReportRouteOutputTestCase (), TestCase::QUICK);
+    AddTestCase (new LeachRouteHolddownTestCase (), TestCase::QUICK);
   }
 } g_leachTestSuite;